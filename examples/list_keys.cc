@@ -0,0 +1,48 @@
+#include "cpptoml.h"
+
+#include <fstream>
+#include <iostream>
+
+int main(int argc, char** argv)
+{
+    if (argc < 2)
+    {
+        std::cout << "Usage: " << argv[0] << " filename" << std::endl;
+        return 1;
+    }
+
+    std::ifstream file{argv[1]};
+    if (!file.is_open())
+    {
+        std::cerr << "Could not open " << argv[1] << std::endl;
+        return 1;
+    }
+
+    // prints every table header and key without converting any values
+    try
+    {
+        cpptoml::toml_reader reader{file};
+        cpptoml::toml_reader::event e;
+        while ((e = reader.next()) != cpptoml::toml_reader::event::END)
+        {
+            std::string name;
+            for (const auto& part : reader.current_key())
+                name += (name.empty() ? "" : ".") + part;
+
+            if (e == cpptoml::toml_reader::event::TABLE)
+                std::cout << "[" << name << "]\n";
+            else if (e == cpptoml::toml_reader::event::TABLE_ARRAY)
+                std::cout << "[[" << name << "]]\n";
+            else
+                std::cout << name << "\n";
+        }
+    }
+    catch (const cpptoml::parse_exception& e)
+    {
+        std::cerr << "Failed to parse " << argv[1] << ": " << e.what()
+                  << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,51 @@
+#include "cpptoml.h"
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+int main(int argc, char** argv)
+{
+    if (argc < 2)
+    {
+        std::cout << "Usage: " << argv[0] << " filename..." << std::endl;
+        return 1;
+    }
+
+    // one thread parses all of the files in a row with the same parser,
+    // so every file is checked against parsing it on its own
+    std::vector<std::string> filenames(argv + 1, argv + argc);
+    cpptoml::parse_options options;
+    options.threads = 1;
+    auto results = cpptoml::parse_files(filenames, options);
+
+    int mismatches = 0;
+    for (std::size_t i = 0; i < filenames.size(); ++i)
+    {
+        std::string expected;
+        try
+        {
+            expected = cpptoml::to_string(*cpptoml::parse_file(filenames[i]));
+        }
+        catch (const cpptoml::parse_exception& e)
+        {
+            expected = e.what();
+        }
+
+        const auto& result = results[i];
+        auto actual = result.root ? cpptoml::to_string(*result.root)
+                                  : result.error;
+        if (actual != expected)
+        {
+            std::cerr << filenames[i] << ": differs from parse_file"
+                      << std::endl;
+            ++mismatches;
+            continue;
+        }
+
+        std::cout << filenames[i] << ": "
+                  << (result.root ? "ok" : result.error) << std::endl;
+    }
+
+    return mismatches > 0 ? 1 : 0;
+}
@@ -10,14 +10,23 @@
 #include <algorithm>
 #include <optional>
 #include <cstdint>
+#include <cstring>
 #include <limits>
 #include <memory>
 #include <stdexcept>
 #include <string>
+#include <string_view>
 #include <unordered_map>
+#include <utility>
 #include <vector>
 #include <iostream>
 
+#if defined(__cpp_impl_coroutine) && defined(__cpp_concepts)
+#define CPPTOMLNG_HAVE_COROUTINES 1
+#include <coroutine>
+#include <exception>
+#endif
+
 namespace cpptomlng
 {
 class writer; // forward declaration
@@ -84,6 +93,24 @@ std::ostream& operator<<(std::ostream& os, const local_datetime& dt);
 
 std::ostream& operator<<(std::ostream& os, const offset_datetime& dt);
 
+namespace detail
+{
+/**
+ * Room for the text of any date or time, whatever its fields hold.
+ */
+constexpr std::size_t datetime_buffer_size = 128;
+
+/**
+ * Writes a date or time the way operator<< does to out, which must have
+ * room for datetime_buffer_size characters. Returns the end of the text.
+ */
+char* format_datetime(char* out, const local_date& dt);
+char* format_datetime(char* out, const local_time& ltime);
+char* format_datetime(char* out, const zone_offset& zo);
+char* format_datetime(char* out, const local_datetime& dt);
+char* format_datetime(char* out, const offset_datetime& dt);
+} // namespace detail
+
 template <class T, class... Ts>
 struct is_one_of;
 
@@ -223,8 +250,44 @@ namespace detail
 {
 template <class T>
 inline std::shared_ptr<T> make_element();
+
+class dom_builder;
+
+/**
+ * Converts the text of an integer or float that the parser has already
+ * checked. Other types are never deferred, so there is nothing to do.
+ */
+void from_lexeme(const std::string& text, int64_t& out);
+void from_lexeme(const std::string& text, double& out);
+
+template <class T>
+void from_lexeme(const std::string&, T&)
+{
+    // nothing
 }
 
+struct write_cache;
+
+/**
+ * What a caching toml_writer keeps about an element it has written. Only
+ * elements written by such a writer have one.
+ */
+struct write_state
+{
+    // the container the element was last written in; a change is passed
+    // up to it as long as it is clean, so a dirty element always has dirty
+    // ancestors
+    std::weak_ptr<const base> parent;
+    bool dirty = true;
+
+    // set once the element turns out to be held by more than one container
+    bool shared = false;
+
+    // what was last written for a table
+    std::shared_ptr<write_cache> cache;
+};
+} // namespace detail
+
 std::shared_ptr<table> make_table();
 std::shared_ptr<table_array> make_table_array(bool is_inline = false);
 
@@ -312,11 +375,52 @@ class base : public std::enable_shared_from_this<base>
     template <class Visitor, class... Args>
     void accept(Visitor&& visitor, Args&&... args) const;
 
+    /**
+     * Records that this element has changed since it was last written, so
+     * that a toml_writer with caching enabled writes the tables holding it
+     * again instead of reusing their output. The mutating members call
+     * this; it only has to be called by hand after changing an element
+     * through an iterator or reference that was obtained earlier.
+     *
+     * Once a caching toml_writer has written the element, this writes to
+     * it and to its containers. The non-const get() and begin() call it
+     * even when only used to read, so threads sharing such a tree must
+     * read it through const references.
+     */
+    void mark_dirty() const
+    {
+        if (!write_state_ || write_state_->dirty)
+            return;
+        write_state_->dirty = true;
+        if (auto parent = write_state_->parent.lock())
+            parent->mark_dirty();
+    }
+
   protected:
     base()
     {
         // nothing
     }
+
+  private:
+    friend class array;
+    friend class table_array;
+    friend class table;
+    friend class toml_writer;
+
+    /**
+     * Forgets parent as the container this element was written in, when
+     * it is removed from it.
+     */
+    void detach_from(const base& parent) const
+    {
+        if (write_state_ && write_state_->parent.lock().get() == &parent)
+            write_state_->parent.reset();
+    }
+
+    // only allocated by a caching toml_writer, so that elements of trees
+    // that are never written that way stay small
+    mutable std::unique_ptr<detail::write_state> write_state_;
 };
 
 /**
@@ -334,6 +438,9 @@ class value : public base
     friend std::shared_ptr<typename value_traits<U>::type>
     cpptomlng::make_value(U&& val);
 
+    friend class detail::dom_builder;
+    friend class toml_writer;
+
   public:
     static_assert(valid_value<T>::value, "invalid value type");
 
@@ -351,10 +458,22 @@ class value : public base
     }
 
     /**
-     * Gets the data associated with this value.
+     * Gets the data associated with this value. Since the data may be
+     * changed through the reference, this drops the text the value was
+     * parsed from, even if it is only read, and marks the value dirty for
+     * a caching toml_writer. Threads sharing a tree must not call it on
+     * the same value concurrently; read through the const version.
      */
     T& get()
     {
+        mark_dirty();
+        convert();
+        if (verbatim_)
+        {
+            // the data may be changed through the reference
+            verbatim_ = false;
+            lexeme_.reset();
+        }
         return data_;
     }
 
@@ -363,11 +482,34 @@ class value : public base
      */
     const T& get() const
     {
+        convert();
         return data_;
     }
 
   private:
-    T data_;
+    /**
+     * Converts the text of a value whose conversion was deferred.
+     */
+    void convert() const
+    {
+        if (deferred_)
+        {
+            detail::from_lexeme(*lexeme_, data_);
+            deferred_ = false;
+            if (!verbatim_)
+                lexeme_.reset();
+        }
+    }
+
+    // mutable so that the const accessor can still convert
+    mutable T data_;
+
+    // the text of the value in the parsed document, kept while data_ is
+    // still to be converted from it, or while it is to be written out as
+    // it was because the value has not been changed
+    mutable std::unique_ptr<const std::string> lexeme_;
+    mutable bool deferred_ = false;
+    bool verbatim_ = false;
 
     /**
      * Constructs a value from the given data.
@@ -404,7 +546,7 @@ inline std::shared_ptr<value<double>> base::as()
         return v;
 
     if (auto v = std::dynamic_pointer_cast<value<int64_t>>(shared_from_this()))
-        return make_value<double>(static_cast<double>(v->get()));
+        return make_value<double>(static_cast<double>(std::as_const(*v).get()));
 
     return nullptr;
 }
@@ -471,6 +613,7 @@ class array : public base
 
     iterator begin()
     {
+        mark_dirty();
         return values_.begin();
     }
 
@@ -494,6 +637,7 @@ class array : public base
      */
     std::vector<std::shared_ptr<base>>& get()
     {
+        mark_dirty();
         return values_;
     }
 
@@ -537,7 +681,7 @@ class array : public base
 
         for (const auto& val : values_)
         {
-            if (auto v = val->as<T>())
+            if (auto v = std::as_const(*val).as<T>())
                 result.push_back(v->get());
             else
                 return {};
@@ -561,6 +705,7 @@ class array : public base
         if (values_.empty() || values_[0]->as<T>())
         {
             values_.push_back(val);
+            mark_dirty();
         }
         else
         {
@@ -591,6 +736,7 @@ class array : public base
     {
         if (values_.empty() || values_[0]->as<T>())
         {
+            mark_dirty();
             return values_.insert(position, value);
         }
         else
@@ -619,6 +765,8 @@ class array : public base
      */
     iterator erase(iterator position)
     {
+        (*position)->detach_from(*this);
+        mark_dirty();
         return values_.erase(position);
     }
 
@@ -627,6 +775,9 @@ class array : public base
      */
     void clear()
     {
+        for (const auto& val : values_)
+            val->detach_from(*this);
+        mark_dirty();
         values_.clear();
     }
 
@@ -718,6 +869,7 @@ class table_array : public base
 
     iterator begin()
     {
+        mark_dirty();
         return array_.begin();
     }
 
@@ -743,6 +895,7 @@ class table_array : public base
 
     std::vector<std::shared_ptr<table>>& get()
     {
+        mark_dirty();
         return array_;
     }
 
@@ -757,6 +910,7 @@ class table_array : public base
     void push_back(const std::shared_ptr<table>& val)
     {
         array_.push_back(val);
+        mark_dirty();
     }
 
     /**
@@ -764,24 +918,19 @@ class table_array : public base
      */
     iterator insert(iterator position, const std::shared_ptr<table>& value)
     {
+        mark_dirty();
         return array_.insert(position, value);
     }
 
     /**
      * Erase an element from the array
      */
-    iterator erase(iterator position)
-    {
-        return array_.erase(position);
-    }
+    iterator erase(iterator position);
 
     /**
      * Clear the array
      */
-    void clear()
-    {
-        array_.clear();
-    }
+    void clear();
 
     /**
      * Reserve space for n tables.
@@ -842,7 +991,7 @@ typename std::enable_if<!std::is_floating_point<T>::value
                         option<T>>::type
 get_impl(const std::shared_ptr<base>& elem)
 {
-    if (auto v = elem->as<int64_t>())
+    if (auto v = std::as_const(*elem).as<int64_t>())
     {
         if (v->get() < (std::numeric_limits<T>::min)())
             throw std::underflow_error{
@@ -866,7 +1015,7 @@ typename std::enable_if<!std::is_same<T, bool>::value
                         option<T>>::type
 get_impl(const std::shared_ptr<base>& elem)
 {
-    if (auto v = elem->as<int64_t>())
+    if (auto v = std::as_const(*elem).as<int64_t>())
     {
         if (v->get() < 0)
             throw std::underflow_error{"T cannot store negative value in get"};
@@ -889,7 +1038,7 @@ typename std::enable_if<!std::is_integral<T>::value
                         option<T>>::type
 get_impl(const std::shared_ptr<base>& elem)
 {
-    if (auto v = elem->as<T>())
+    if (auto v = std::as_const(*elem).as<T>())
     {
         return {v->get()};
     }
@@ -899,6 +1048,13 @@ get_impl(const std::shared_ptr<base>& elem)
     }
 }
 
+namespace detail
+{
+struct lazy_document;
+struct lazy_section;
+struct parse_scratch;
+}
+
 /**
  * Represents a TOML keytable.
  */
@@ -906,6 +1062,8 @@ class table : public base
 {
   public:
     friend class table_array;
+    friend class parser;
+    friend class toml_writer;
     friend std::shared_ptr<table> make_table();
 
     std::shared_ptr<base> clone() const override;
@@ -922,21 +1080,26 @@ class table : public base
 
     iterator begin()
     {
+        load();
+        mark_dirty();
         return map_.begin();
     }
 
     const_iterator begin() const
     {
+        load();
         return map_.begin();
     }
 
     iterator end()
     {
+        load();
         return map_.end();
     }
 
     const_iterator end() const
     {
+        load();
         return map_.end();
     }
 
@@ -947,6 +1110,7 @@ class table : public base
 
     bool empty() const
     {
+        load();
         return map_.empty();
     }
 
@@ -955,6 +1119,7 @@ class table : public base
      */
     bool contains(const std::string& key) const
     {
+        load();
         return map_.find(key) != map_.end();
     }
 
@@ -974,6 +1139,7 @@ class table : public base
      */
     std::shared_ptr<base> get(const std::string& key) const
     {
+        load();
         return map_.at(key);
     }
 
@@ -1105,11 +1271,11 @@ class table : public base
         if (auto v = get_array(key))
         {
             std::vector<T> result;
-            result.reserve(v->get().size());
+            result.reserve(std::as_const(*v).get().size());
 
-            for (const auto& b : v->get())
+            for (const auto& b : std::as_const(*v).get())
             {
-                if (auto val = b->as<T>())
+                if (auto val = std::as_const(*b).as<T>())
                     result.push_back(val->get());
                 else
                     return {};
@@ -1137,11 +1303,11 @@ class table : public base
         if (auto v = get_array_qualified(key))
         {
             std::vector<T> result;
-            result.reserve(v->get().size());
+            result.reserve(std::as_const(*v).get().size());
 
-            for (const auto& b : v->get())
+            for (const auto& b : std::as_const(*v).get())
             {
-                if (auto val = b->as<T>())
+                if (auto val = std::as_const(*b).as<T>())
                     result.push_back(val->get());
                 else
                     return {};
@@ -1157,7 +1323,12 @@ class table : public base
      */
     void insert(const std::string& key, const std::shared_ptr<base>& value)
     {
-        map_[key] = value;
+        load();
+        auto& slot = map_[key];
+        if (slot)
+            slot->detach_from(*this);
+        slot = value;
+        mark_dirty();
     }
 
     /**
@@ -1176,7 +1347,21 @@ class table : public base
      */
     void erase(const std::string& key)
     {
-        map_.erase(key);
+        load();
+        auto it = map_.find(key);
+        if (it != map_.end())
+            erase(it);
+    }
+
+    /**
+     * Removes the element at the given position from the table.
+     */
+    iterator erase(iterator position)
+    {
+        load();
+        position->second->detach_from(*this);
+        mark_dirty();
+        return map_.erase(position);
     }
 
     /**
@@ -1184,6 +1369,7 @@ class table : public base
      */
     size_t size()
     {
+        load();
         return map_.size();
     }
 
@@ -1207,7 +1393,22 @@ class table : public base
     bool resolve_qualified(const std::string& key,
                            std::shared_ptr<base>* p = nullptr) const;
 
-    string_to_base_map map_;
+    /**
+     * Parses the keys of a lazily parsed table the first time anything
+     * looks at it. Threads looking at the same table wait for the one
+     * that parses it.
+     */
+    void load() const
+    {
+        if (source_)
+            load_source();
+    }
+
+    void load_source() const;
+
+    // filled in by load(), which even const accessors call
+    mutable string_to_base_map map_;
+    std::shared_ptr<detail::lazy_section> source_;
 };
 
 /**
@@ -1226,9 +1427,9 @@ table::get_array_of<array>(const std::string& key) const
     if (auto v = get_array(key))
     {
         std::vector<std::shared_ptr<array>> result;
-        result.reserve(v->get().size());
+        result.reserve(std::as_const(*v).get().size());
 
-        for (const auto& b : v->get())
+        for (const auto& b : std::as_const(*v).get())
         {
             if (auto val = b->as_array())
                 result.push_back(val);
@@ -1258,9 +1459,9 @@ table::get_qualified_array_of<array>(const std::string& key) const
     if (auto v = get_array_qualified(key))
     {
         std::vector<std::shared_ptr<array>> result;
-        result.reserve(v->get().size());
+        result.reserve(std::as_const(*v).get().size());
 
-        for (const auto& b : v->get())
+        for (const auto& b : std::as_const(*v).get())
         {
             if (auto val = b->as_array())
                 result.push_back(val);
@@ -1288,7 +1489,7 @@ inline std::shared_ptr<table> make_element<table>()
 template <class T>
 std::shared_ptr<base> value<T>::clone() const
 {
-    return make_value(data_);
+    return make_value(get());
 }
 
 inline std::shared_ptr<base> array::clone() const
@@ -1312,11 +1513,26 @@ inline std::shared_ptr<base> table_array::clone() const
 inline std::shared_ptr<base> table::clone() const
 {
     auto result = make_table();
-    for (const auto& pr : map_)
+    for (const auto& pr : *this)
         result->insert(pr.first, pr.second->clone());
     return result;
 }
 
+inline table_array::iterator table_array::erase(iterator position)
+{
+    (*position)->detach_from(*this);
+    mark_dirty();
+    return array_.erase(position);
+}
+
+inline void table_array::clear()
+{
+    for (const auto& val : array_)
+        val->detach_from(*this);
+    mark_dirty();
+    array_.clear();
+}
+
 /**
  * Exception class for all TOML parsing errors.
  */
@@ -1333,29 +1549,275 @@ class parse_exception : public std::runtime_error
     }
 };
 
+namespace detail
+{
+struct structural_index;
+}
+
 /**
- * The parser class.
+ * The ways a parser can go about reading a document.
  */
-class parser
+enum class parse_engine
+{
+    /**
+     * Reads and parses the input one line at a time.
+     */
+    LINE,
+
+    /**
+     * Reads the whole input first and indexes where its statements,
+     * strings and arrays are in a separate pass, then builds the tree by
+     * walking that index without copying lines.
+     */
+    INDEXED
+};
+
+/**
+ * Options controlling how a parser reads a document.
+ */
+struct parse_options
+{
+    parse_engine engine = parse_engine::LINE;
+
+    /**
+     * Keeps the text of integers and floats and only converts it the first
+     * time value::get() is called. The text is still checked while parsing,
+     * so errors are reported up front. Numbers that could overflow are
+     * converted right away. Since the first get() writes to the value,
+     * threads sharing a tree must not read the same value concurrently.
+     */
+    bool defer_conversion = false;
+
+    /**
+     * Only parses the table headers up front. The keys of each table are
+     * parsed from a copy of the document the first time the table is
+     * looked at, so errors in them are reported then, by the accessor,
+     * and again by every later access to that table. Threads may share
+     * the tree: the first to look at a table parses it while the others
+     * wait. The whole input is read and indexed as for
+     * parse_engine::INDEXED.
+     */
+    bool lazy = false;
+
+    /**
+     * The number of threads the bodies of tables are parsed on; 0 uses
+     * one per core. With more than one, the whole input is read and
+     * indexed as for parse_engine::INDEXED, the table headers are parsed
+     * in order and the tables in between are handed out to the threads.
+     * A table that a later header reaches into is still parsed in order.
+     * Ignored when parsing lazily.
+     */
+    unsigned threads = 1;
+
+    /**
+     * Reads a stream on a separate thread, one large block ahead of the
+     * line engine, so that a slow producer and the parser can work at
+     * the same time. Up to two blocks past where the parser stopped are
+     * taken from the stream, and a parse() that fails still waits for
+     * the read under way, so it only returns once the producer has sent
+     * more or closed the stream. The indexed engine and documents in
+     * memory don't use it.
+     */
+    bool pipelined = false;
+
+    /**
+     * Keeps the text every single-line string, number, boolean and date
+     * was written as, so that toml_writer writes the values that have not
+     * been changed since exactly as they were in the document instead of
+     * formatting them again. This costs a string for every such value.
+     * Calling the non-const value::get() drops the text even if the value
+     * is only read, and, as with defer_conversion, writes to the value,
+     * so threads sharing a tree must read it through const references.
+     */
+    bool keep_source_text = false;
+};
+
+/**
+ * Receives the events produced by a sax_parser while it walks a TOML
+ * document. Every callback does nothing by default, so handlers only need
+ * to override the events they care about.
+ *
+ * Keys and table names are reported as their dotted components. Each key
+ * is followed by exactly one value: either a single scalar callback, or a
+ * begin_array()/begin_inline_table() that is closed by the matching end
+ * callback. The arguments are only valid for the duration of the call.
+ */
+class sax_handler
+{
+  public:
+    virtual ~sax_handler() = default;
+
+    /**
+     * Called for a [table] header.
+     */
+    virtual void table_header(const std::vector<std::string>&)
+    {
+        // nothing
+    }
+
+    /**
+     * Called for a [[table array]] header.
+     */
+    virtual void table_array_header(const std::vector<std::string>&)
+    {
+        // nothing
+    }
+
+    /**
+     * Called for the key of a key/value pair. The key is relative to the
+     * innermost open inline table, or else to the last table header.
+     */
+    virtual void key(const std::vector<std::string>&)
+    {
+        // nothing
+    }
+
+    virtual void string_value(const std::string&)
+    {
+        // nothing
+    }
+
+    virtual void integer_value(int64_t)
+    {
+        // nothing
+    }
+
+    virtual void float_value(double)
+    {
+        // nothing
+    }
+
+    /**
+     * Called instead of integer_value() when the parser defers
+     * conversions, with the already checked text of the integer.
+     */
+    virtual void integer_lexeme(const std::string& text)
+    {
+        int64_t v;
+        detail::from_lexeme(text, v);
+        integer_value(v);
+    }
+
+    /**
+     * Called instead of float_value() when the parser defers conversions,
+     * with the already checked text of the float.
+     */
+    virtual void float_lexeme(const std::string& text)
+    {
+        double v;
+        detail::from_lexeme(text, v);
+        float_value(v);
+    }
+
+    virtual void boolean_value(bool)
+    {
+        // nothing
+    }
+
+    /**
+     * Called right after the callback for a string, number, boolean or
+     * date when the parser keeps source text, with the text the value was
+     * written as. Multi-line strings are not reported.
+     */
+    virtual void value_text(std::string_view)
+    {
+        // nothing
+    }
+
+    virtual void local_date_value(const local_date&)
+    {
+        // nothing
+    }
+
+    virtual void local_time_value(const local_time&)
+    {
+        // nothing
+    }
+
+    virtual void local_datetime_value(const local_datetime&)
+    {
+        // nothing
+    }
+
+    virtual void offset_datetime_value(const offset_datetime&)
+    {
+        // nothing
+    }
+
+    virtual void begin_array()
+    {
+        // nothing
+    }
+
+    virtual void end_array()
+    {
+        // nothing
+    }
+
+    virtual void begin_inline_table()
+    {
+        // nothing
+    }
+
+    virtual void end_inline_table()
+    {
+        // nothing
+    }
+};
+
+/**
+ * An event-based parser. Instead of building a tree of tables, it reports
+ * the structure of the document to a sax_handler as it goes, so its memory
+ * use does not grow with the size of the document.
+ *
+ * The sax_parser checks the syntax of the document and that arrays are
+ * homogeneous. Rules that need to know the whole document, such as
+ * duplicate keys or redefined tables, are left to the handler.
+ */
+class sax_parser
 {
   public:
     /**
      * Parsers are constructed from streams.
      */
-    parser(std::istream& stream) : input_(stream)
+    sax_parser(std::istream& stream, sax_handler& handler)
+        : input_(&stream), handler_(handler)
     {
         // nothing
     }
 
-    parser& operator=(const parser& parser) = delete;
+    /**
+     * Parsers can also read a document that is already in memory. The
+     * buffer must outlive the call to parse().
+     */
+    sax_parser(const char* data, std::size_t len, sax_handler& handler)
+        : buffer_(data), buffer_end_(data + len), handler_(handler)
+    {
+        // nothing
+    }
+
+    sax_parser& operator=(const sax_parser& parser) = delete;
 
     /**
      * Parses the stream this parser was created on until EOF.
      * @throw parse_exception if there are errors in parsing
      */
-    std::shared_ptr<table> parse();
+    void parse();
+
+    /**
+     * The line currently being parsed, starting at 1.
+     */
+    std::size_t line_number() const
+    {
+        return line_number_;
+    }
 
   private:
+    friend class parser;
+    friend class push_parser;
+    friend class table;
+    friend class toml_reader;
+
 #if defined _MSC_VER
     __declspec(noreturn)
 #elif defined __GNUC__
@@ -1366,29 +1828,47 @@ class parser
         throw parse_exception{err, line_number_};
     }
 
-    void parse_table(std::string::iterator& it,
-                     const std::string::iterator& end, table*& curr_table);
-
-    void parse_single_table(std::string::iterator& it,
-                            const std::string::iterator& end,
-                            table*& curr_table);
-
-    void parse_table_array(std::string::iterator& it,
-                           const std::string::iterator& end, table*& curr_table);
+    /**
+     * Starts over on another document, keeping the buffers.
+     */
+    void reset(std::istream* stream, const char* data, const char* data_end)
+    {
+        input_ = stream;
+        buffer_ = data;
+        buffer_end_ = data_end;
+        buffer_is_final_ = true;
+        document_ = nullptr;
+        index_ = nullptr;
+        next_line_ = 0;
+        line_.clear();
+        value_.clear();
+        key_.clear();
+        line_number_ = 0;
+    }
 
-    void parse_key_value(std::string::iterator& it, std::string::iterator& end,
-                         table* curr_table);
+    /**
+     * Reads the next line of input and points line_begin_ and line_end_ at
+     * it.
+     */
+    bool next_line();
 
-    template <class KeyEndFinder, class KeyPartHandler>
-    std::string
-    parse_key(std::string::iterator& it, const std::string::iterator& end,
-              KeyEndFinder&& key_end, KeyPartHandler&& key_part_handler);
+    /**
+     * Parses the statement, if any, on the line just read.
+     */
+    void parse_line();
 
-    std::string parse_simple_key(std::string::iterator& it,
-                                 const std::string::iterator& end);
+    /**
+     * Parses a document in place, visiting only the lines the structural
+     * index says start a statement.
+     */
+    void parse_indexed();
 
-    std::string parse_bare_key(std::string::iterator& it,
-                               const std::string::iterator& end);
+    /**
+     * Parses statements [first, last) of an indexed document. Returns false
+     * as soon as the parser and the index disagree about where one of them
+     * ends.
+     */
+    bool parse_statements(std::size_t first, std::size_t last);
 
     enum class parse_type
     {
@@ -1404,49 +1884,76 @@ class parser
         INLINE_TABLE
     };
 
-    std::shared_ptr<base> parse_value(std::string::iterator& it,
-                                      std::string::iterator& end);
+    void parse_table(std::string::iterator& it,
+                     const std::string::iterator& end);
 
-    parse_type determine_value_type(const std::string::iterator& it,
-                                    const std::string::iterator& end);
+    void parse_single_table(std::string::iterator& it,
+                            const std::string::iterator& end);
 
-    parse_type determine_number_type(const std::string::iterator& it,
-                                     const std::string::iterator& end);
+    void parse_table_array(std::string::iterator& it,
+                           const std::string::iterator& end);
 
-    std::shared_ptr<value<std::string>> parse_string(std::string::iterator& it,
-                                                     std::string::iterator& end);
+    void parse_key_value(std::string::iterator& it,
+                         std::string::iterator& end);
 
-    std::shared_ptr<value<std::string>>
-    parse_multiline_string(std::string::iterator& it,
-                           std::string::iterator& end, char delim);
+    template <class KeyEndFinder>
+    void parse_key(std::string::iterator& it,
+                   const std::string::iterator& end, KeyEndFinder&& key_end);
 
-    std::string string_literal(std::string::iterator& it,
-                               const std::string::iterator& end, char delim);
+    std::string parse_simple_key(std::string::iterator& it,
+                                 const std::string::iterator& end);
 
-    std::string parse_escape_code(std::string::iterator& it,
-                                  const std::string::iterator& end);
+    std::string parse_bare_key(std::string::iterator& it,
+                               const std::string::iterator& end);
+
+    /**
+     * Parses a value, and reports its text as well when source text is
+     * kept.
+     */
+    parse_type parse_value(std::string::iterator& it,
+                           std::string::iterator& end);
+
+    parse_type parse_value_impl(std::string::iterator& it,
+                                std::string::iterator& end);
+
+    parse_type determine_value_type(const std::string::iterator& it,
+                                    const std::string::iterator& end);
+
+    parse_type determine_number_type(const std::string::iterator& it,
+                                     const std::string::iterator& end);
+
+    void parse_string(std::string::iterator& it, std::string::iterator& end);
+
+    void parse_multiline_string(std::string::iterator& it,
+                                std::string::iterator& end, char delim,
+                                std::string& str);
 
-    std::string parse_unicode(std::string::iterator& it,
-                              const std::string::iterator& end);
+    void string_literal(std::string::iterator& it,
+                        const std::string::iterator& end, char delim,
+                        std::string& val);
 
-    uint32_t parse_hex(std::string::iterator& it,
-                       const std::string::iterator& end, uint32_t place);
+    void parse_escape_code(std::string::iterator& it,
+                           const std::string::iterator& end,
+                           std::string& out);
 
-    uint32_t hex_to_digit(char c);
+    void parse_unicode(std::string::iterator& it,
+                       const std::string::iterator& end, std::string& out);
 
-    std::shared_ptr<base> parse_number(std::string::iterator& it,
-                                       const std::string::iterator& end);
+    parse_type parse_number(std::string::iterator& it,
+                            const std::string::iterator& end);
+
+    int64_t parse_int(std::string::iterator& it,
+                      const std::string::iterator& end, int base = 10,
+                      const char* prefix = "");
 
-    std::shared_ptr<value<int64_t>> parse_int(std::string::iterator& it,
-                                              const std::string::iterator& end,
-                                              int base = 10,
-                                              const char* prefix = "");
+    double parse_float(std::string::iterator& it,
+                       const std::string::iterator& end);
 
-    std::shared_ptr<value<double>> parse_float(std::string::iterator& it,
-                                               const std::string::iterator& end);
+    void defer_number(std::string::iterator& it,
+                      const std::string::iterator& end, bool is_float);
 
-    std::shared_ptr<value<bool>> parse_bool(std::string::iterator& it,
-                                            const std::string::iterator& end);
+    void parse_bool(std::string::iterator& it,
+                    const std::string::iterator& end);
 
     std::string::iterator find_end_of_number(std::string::iterator it,
                                              std::string::iterator end);
@@ -1460,30 +1967,39 @@ class parser
     local_time read_time(std::string::iterator& it,
                          const std::string::iterator& end);
 
-    std::shared_ptr<value<local_time>>
-    parse_time(std::string::iterator& it, const std::string::iterator& end);
+    void parse_time(std::string::iterator& it,
+                    const std::string::iterator& end);
 
-    std::shared_ptr<base> parse_date(std::string::iterator& it,
-                                     const std::string::iterator& end);
+    parse_type parse_date(std::string::iterator& it,
+                          const std::string::iterator& end);
 
-    std::shared_ptr<base> parse_array(std::string::iterator& it,
-                                      std::string::iterator& end);
+    option<parse_type> parse_datetime_fast(std::string::iterator& it,
+                                           const std::string::iterator& end);
+
+    void parse_array(std::string::iterator& it, std::string::iterator& end);
 
-    template <class Value>
-    std::shared_ptr<array> parse_value_array(std::string::iterator& it,
-                                             std::string::iterator& end);
+    void parse_value_array(std::string::iterator& it,
+                           std::string::iterator& end);
 
-    template <class Object, class Function>
-    std::shared_ptr<Object> parse_object_array(Function&& fun, char delim,
-                                               std::string::iterator& it,
-                                               std::string::iterator& end);
+    template <class Function>
+    void parse_object_array(Function&& fun, char delim,
+                            std::string::iterator& it,
+                            std::string::iterator& end);
 
-    std::shared_ptr<table> parse_inline_table(std::string::iterator& it,
-                                              std::string::iterator& end);
+    void parse_inline_table(std::string::iterator& it,
+                            std::string::iterator& end);
 
     void skip_whitespace_and_comments(std::string::iterator& start,
                                       std::string::iterator& end);
 
+    /**
+     * Moves past a value without converting it, following strings and
+     * brackets onto further lines as needed.
+     */
+    void skip_value(std::string::iterator& it, std::string::iterator& end);
+
+    void skip_string(std::string::iterator& it, std::string::iterator& end);
+
     void consume_whitespace(std::string::iterator& it,
                             const std::string::iterator& end);
 
@@ -1499,16 +2015,486 @@ class parser
     option<parse_type> date_type(const std::string::iterator& it,
                                  const std::string::iterator& end);
 
-    std::istream& input_;
+    std::istream* input_ = nullptr;
+    const char* buffer_ = nullptr;
+    const char* buffer_end_ = nullptr;
+    bool buffer_is_final_ = true;
+    std::string* document_ = nullptr;
+    const detail::structural_index* index_ = nullptr;
+    std::size_t next_line_ = 0;
+    bool defer_numbers_ = false;
+    bool keep_text_ = false;
+    sax_handler& handler_;
     std::string line_;
+    std::string::iterator line_begin_;
+    std::string::iterator line_end_;
+    std::string value_;
+    std::vector<std::string> key_;
     std::size_t line_number_ = 0;
 };
 
+/**
+ * The parser class. It runs a sax_parser with a handler that builds the
+ * tree of tables, enforcing the rules about redefining keys and tables.
+ */
+class parser
+{
+  public:
+    /**
+     * Parsers are constructed from streams.
+     */
+    parser(std::istream& stream, const parse_options& options = {});
+
+    /**
+     * Parsers can also read a document that is already in memory. The
+     * buffer must outlive the call to parse().
+     */
+    parser(const char* data, std::size_t len,
+           const parse_options& options = {});
+
+    ~parser();
+
+    parser& operator=(const parser& parser) = delete;
+
+    /**
+     * Points the parser at another stream. The buffers it grew while
+     * parsing earlier documents are kept, so parsing many small documents
+     * with one parser allocates little besides the tables and values.
+     */
+    void reset(std::istream& stream)
+    {
+        input_ = &stream;
+        buffer_ = buffer_end_ = nullptr;
+    }
+
+    /**
+     * Points the parser at another document in memory, like reset().
+     */
+    void reset(const char* data, std::size_t len)
+    {
+        input_ = nullptr;
+        buffer_ = data;
+        buffer_end_ = data + len;
+    }
+
+    /**
+     * Parses the stream this parser was created on until EOF.
+     * @throw parse_exception if there are errors in parsing
+     */
+    std::shared_ptr<table> parse();
+
+    /**
+     * Parses the stream like parse(), but only builds the parts of the
+     * document named by the given qualified keys (e.g. "database" or
+     * "server.port") and the tables leading up to them. Everything else is
+     * skipped without being converted and only checked for where it ends.
+     * The document is always read line by line, so of the parse_options
+     * only defer_conversion and keep_source_text apply.
+     * @throw parse_exception if there are errors in parsing
+     */
+    std::shared_ptr<table> parse(const std::vector<std::string>& projection);
+
+  private:
+    std::shared_ptr<table> parse_lazily();
+
+    std::shared_ptr<table> parse_in_parallel(unsigned threads);
+
+    std::shared_ptr<table>
+    parse_headers(const std::shared_ptr<detail::lazy_document>& document,
+                  std::vector<table*>& sections);
+
+    void read_document(std::string& document);
+
+    std::istream* input_ = nullptr;
+    const char* buffer_ = nullptr;
+    const char* buffer_end_ = nullptr;
+    parse_options options_;
+    std::unique_ptr<detail::parse_scratch> scratch_;
+};
+
+/**
+ * A parser that is handed the document piece by piece instead of pulling
+ * it from a stream, e.g. as chunks arrive on a non-blocking socket. Chunks
+ * may split the document anywhere, including in the middle of a key, a
+ * string or an array; complete statements are parsed as soon as they are
+ * available and the rest is kept until more input arrives.
+ *
+ * After a parse_exception the parser cannot be fed any more input.
+ */
+class push_parser
+{
+  public:
+    /**
+     * Constructs a push_parser that builds a table, returned by finish().
+     */
+    push_parser();
+
+    /**
+     * Constructs a push_parser that reports events to the given handler
+     * instead of building a table.
+     */
+    push_parser(sax_handler& handler);
+
+    ~push_parser();
+
+    push_parser(const push_parser&) = delete;
+    push_parser& operator=(const push_parser&) = delete;
+
+    /**
+     * Adds the next chunk of the document.
+     * @throw parse_exception if there are errors in parsing
+     */
+    void feed(const char* data, std::size_t len);
+
+    /**
+     * Signals the end of the document and parses whatever is left.
+     * Returns the root table, or nullptr if events went to a handler.
+     * @throw parse_exception if there are errors in parsing
+     */
+    std::shared_ptr<table> finish();
+
+  private:
+    enum class scan_state
+    {
+        NORMAL,
+        COMMENT,
+        BASIC_STRING,
+        LITERAL_STRING,
+        MULTILINE_BASIC_STRING,
+        MULTILINE_LITERAL_STRING
+    };
+
+    /**
+     * Advances the scanner over the buffered input, recording where the
+     * last complete statement ends. Returns early if it needs to look at
+     * characters that have not arrived yet, unless at_eof is set.
+     */
+    void scan(bool at_eof);
+
+    /**
+     * Hands the first len bytes of the buffer to the parser and drops them.
+     * is_final says whether they run up to the end of the document.
+     */
+    void parse_prefix(std::size_t len, bool is_final);
+
+    std::unique_ptr<detail::dom_builder> builder_;
+    sax_parser parser_;
+    std::string buffer_;
+    std::size_t scanned_ = 0;
+    std::size_t complete_ = 0;
+    scan_state state_ = scan_state::NORMAL;
+    int depth_ = 0;
+};
+
+#ifdef CPPTOMLNG_HAVE_COROUTINES
+/**
+ * A source of bytes for async_parse: read(data, len) returns something
+ * that can be co_await-ed and yields how many bytes it stored in data, at
+ * most len, or 0 once the input has ended. Where the awaiting coroutine is
+ * resumed (an event loop, a thread pool) is up to the source.
+ */
+template <class Source>
+concept async_byte_source
+    = requires(Source& source, char* data, std::size_t len) {
+          source.read(data, len);
+      };
+
+/**
+ * The result of async_parse. Nothing happens until it is co_await-ed,
+ * which yields the root table or throws the parse_exception.
+ */
+class parse_task
+{
+  public:
+    struct promise_type
+    {
+        std::shared_ptr<table> root;
+        std::exception_ptr error;
+        std::coroutine_handle<> continuation;
+
+        parse_task get_return_object()
+        {
+            return parse_task{
+                std::coroutine_handle<promise_type>::from_promise(*this)};
+        }
+
+        std::suspend_always initial_suspend() noexcept
+        {
+            return {};
+        }
+
+        auto final_suspend() noexcept
+        {
+            // resumes whoever is waiting for the table
+            struct awaiter
+            {
+                bool await_ready() noexcept
+                {
+                    return false;
+                }
+
+                std::coroutine_handle<>
+                await_suspend(std::coroutine_handle<promise_type> h) noexcept
+                {
+                    auto next = h.promise().continuation;
+                    return next ? next : std::noop_coroutine();
+                }
+
+                void await_resume() noexcept
+                {
+                    // nothing
+                }
+            };
+            return awaiter{};
+        }
+
+        void return_value(std::shared_ptr<table> result)
+        {
+            root = std::move(result);
+        }
+
+        void unhandled_exception()
+        {
+            error = std::current_exception();
+        }
+    };
+
+    parse_task(parse_task&& other) noexcept
+        : handle_(std::exchange(other.handle_, nullptr))
+    {
+        // nothing
+    }
+
+    parse_task& operator=(parse_task&& other) noexcept
+    {
+        if (this != &other)
+        {
+            if (handle_)
+                handle_.destroy();
+            handle_ = std::exchange(other.handle_, nullptr);
+        }
+        return *this;
+    }
+
+    ~parse_task()
+    {
+        if (handle_)
+            handle_.destroy();
+    }
+
+    bool await_ready() const noexcept
+    {
+        return false;
+    }
+
+    std::coroutine_handle<>
+    await_suspend(std::coroutine_handle<> awaiting) noexcept
+    {
+        handle_.promise().continuation = awaiting;
+        return handle_;
+    }
+
+    std::shared_ptr<table> await_resume()
+    {
+        auto& promise = handle_.promise();
+        if (promise.error)
+            std::rethrow_exception(promise.error);
+        return std::move(promise.root);
+    }
+
+  private:
+    explicit parse_task(std::coroutine_handle<promise_type> handle)
+        : handle_(handle)
+    {
+        // nothing
+    }
+
+    std::coroutine_handle<promise_type> handle_;
+};
+
+/**
+ * Parses a document read from an async_byte_source, suspending whenever
+ * the source has to wait for input instead of blocking a thread. The
+ * chunks are handed to a push_parser as they arrive, so complete
+ * statements are parsed while the rest is still on its way.
+ *
+ * The source is taken by reference and must outlive the returned task.
+ */
+template <async_byte_source Source>
+parse_task async_parse(Source& source)
+{
+    push_parser parser;
+    std::unique_ptr<char[]> buffer{new char[1 << 14]};
+    while (true)
+    {
+        std::size_t len = co_await source.read(buffer.get(), 1 << 14);
+        if (len == 0)
+            break;
+        parser.feed(buffer.get(), len);
+    }
+    co_return parser.finish();
+}
+#endif
+
+/**
+ * A pull-style reader that walks the document one table header or key at
+ * a time. Values are only converted when asked for with value(); anything
+ * the caller is not interested in can be passed over with skip(), which
+ * scans for the end of strings, arrays and inline tables (or whole
+ * sections) without building anything.
+ *
+ * Skipped input is only checked for where it ends, and rules that need the
+ * whole document, such as duplicate keys or redefined tables, are not
+ * enforced.
+ */
+class toml_reader : private sax_handler
+{
+  public:
+    enum class event
+    {
+        NONE,
+        TABLE,
+        TABLE_ARRAY,
+        KEY,
+        END
+    };
+
+    /**
+     * Readers are constructed from streams.
+     */
+    toml_reader(std::istream& stream);
+
+    /**
+     * Readers can also read a document that is already in memory. The
+     * buffer must outlive the reader.
+     */
+    toml_reader(const char* data, std::size_t len);
+
+    ~toml_reader();
+
+    toml_reader(const toml_reader&) = delete;
+    toml_reader& operator=(const toml_reader&) = delete;
+
+    /**
+     * Moves to the next table header or key, passing over the value of the
+     * current key if it has not been read. Returns END once the document
+     * is exhausted.
+     * @throw parse_exception if there are errors in parsing
+     */
+    event next();
+
+    /**
+     * The event the reader is currently positioned on.
+     */
+    event current() const
+    {
+        return event_;
+    }
+
+    /**
+     * The dotted key of the current key, relative to current_table(), or
+     * the full name of the current table header.
+     */
+    const std::vector<std::string>& current_key() const
+    {
+        return event_ == event::KEY ? key_ : table_;
+    }
+
+    /**
+     * The name of the table the current key belongs to.
+     */
+    const std::vector<std::string>& current_table() const
+    {
+        return table_;
+    }
+
+    /**
+     * Converts and returns the value of the current key. Returns nullptr
+     * if the reader is not on a key or its value was already consumed.
+     * @throw parse_exception if there are errors in parsing
+     */
+    std::shared_ptr<base> value();
+
+    /**
+     * On a key, passes over its value. On a table header, passes over the
+     * table and every table nested under it that directly follows, so that
+     * the next call to next() returns the first header outside of it.
+     * @throw parse_exception if there are errors in parsing
+     */
+    void skip();
+
+  private:
+    friend class parser;
+
+    void table_header(const std::vector<std::string>& path) override;
+    void table_array_header(const std::vector<std::string>& path) override;
+    void key(const std::vector<std::string>& path) override;
+    void string_value(const std::string& v) override;
+    void integer_value(int64_t v) override;
+    void float_value(double v) override;
+    void integer_lexeme(const std::string& text) override;
+    void float_lexeme(const std::string& text) override;
+    void boolean_value(bool v) override;
+    void value_text(std::string_view text) override;
+    void local_date_value(const local_date& v) override;
+    void local_time_value(const local_time& v) override;
+    void local_datetime_value(const local_datetime& v) override;
+    void offset_datetime_value(const offset_datetime& v) override;
+    void begin_array() override;
+    void end_array() override;
+    void begin_inline_table() override;
+    void end_inline_table() override;
+
+    /**
+     * Reads lines up to the next statement and leaves it_ on its first
+     * character. Returns false at the end of the document.
+     */
+    bool next_statement();
+
+    /**
+     * Passes over whatever is left of the current key/value pair.
+     */
+    void finish_key_value();
+
+    std::unique_ptr<detail::dom_builder> values_;
+    sax_parser parser_;
+    std::string::iterator it_;
+    std::string::iterator end_;
+    event event_ = event::NONE;
+    bool value_pending_ = false;
+    bool lookahead_ = false;
+    std::vector<std::string> table_;
+    std::vector<std::string> key_;
+};
+
 /**
  * Utility function to parse a file as a TOML file. Returns the root table.
  * Throws a parse_exception if the file cannot be opened.
  */
-std::shared_ptr<table> parse_file(const std::string& filename);
+std::shared_ptr<table> parse_file(const std::string& filename,
+                                  const parse_options& options = {});
+
+/**
+ * The outcome of parsing one of the files given to parse_files(). On
+ * failure root is null and error holds the message of the exception.
+ */
+struct file_parse_result
+{
+    std::shared_ptr<table> root;
+    std::string error;
+};
+
+/**
+ * Parses many files at once, each of them on one of options.threads
+ * threads (0 uses one per core). Threads take the next batch of files as
+ * soon as they are done with one; on Linux, builds with the io_uring
+ * option read each batch with a handful of system calls. Returns one
+ * result per file, in the same order, instead of throwing when a file
+ * cannot be opened or parsed.
+ */
+std::vector<file_parse_result>
+parse_files(const std::vector<std::string>& filenames,
+            const parse_options& options = {});
 
 template <class... Ts>
 struct value_accept;
@@ -1516,66 +2502,254 @@ struct value_accept;
 template <>
 struct value_accept<>
 {
-    template <class Visitor, class... Args>
-    static void accept(const base&, Visitor&&, Args&&...)
+    template <class Visitor, class... Args>
+    static void accept(const base&, Visitor&&, Args&&...)
+    {
+        // nothing
+    }
+};
+
+template <class T, class... Ts>
+struct value_accept<T, Ts...>
+{
+    template <class Visitor, class... Args>
+    static void accept(const base& b, Visitor&& visitor, Args&&... args)
+    {
+        // a plain cast, as taking a shared_ptr for every value costs two
+        // atomic operations per type tried
+        if (auto v = dynamic_cast<const value<T>*>(&b))
+        {
+            visitor.visit(*v, std::forward<Args>(args)...);
+        }
+        else
+        {
+            value_accept<Ts...>::accept(b, std::forward<Visitor>(visitor),
+                                        std::forward<Args>(args)...);
+        }
+    }
+};
+
+/**
+ * base implementation of accept() that calls visitor.visit() on the concrete
+ * class.
+ */
+template <class Visitor, class... Args>
+void base::accept(Visitor&& visitor, Args&&... args) const
+{
+    if (is_value())
+    {
+        using value_acceptor
+            = value_accept<std::string, int64_t, double, bool, local_date,
+                           local_time, local_datetime, offset_datetime>;
+        value_acceptor::accept(*this, std::forward<Visitor>(visitor),
+                               std::forward<Args>(args)...);
+    }
+    else if (is_table())
+    {
+        visitor.visit(static_cast<const table&>(*this),
+                      std::forward<Args>(args)...);
+    }
+    else if (is_array())
+    {
+        visitor.visit(static_cast<const array&>(*this),
+                      std::forward<Args>(args)...);
+    }
+    else if (is_table_array())
+    {
+        visitor.visit(static_cast<const table_array&>(*this),
+                      std::forward<Args>(args)...);
+    }
+}
+
+/**
+ * Where a toml_writer puts its output. Writes are collected in a large
+ * buffer that is handed on in one piece when it fills up or on flush(),
+ * so the many small writes of a document cost a copy each rather than a
+ * call into a stream.
+ *
+ * Output still in the buffer when a sink is destroyed is flushed, but
+ * errors are only reported by an explicit flush().
+ */
+class output_sink
+{
+  public:
+    static constexpr std::size_t buffer_size = 1 << 16;
+
+    output_sink()
+        : buffer_(new char[buffer_size]),
+          pos_(buffer_.get()),
+          end_(buffer_.get() + buffer_size)
+    {
+        // nothing
+    }
+
+    virtual ~output_sink() = default;
+
+    output_sink(const output_sink&) = delete;
+    output_sink& operator=(const output_sink&) = delete;
+
+    void write(const char* data, std::size_t len)
+    {
+        if (len <= static_cast<std::size_t>(end_ - pos_))
+        {
+            std::memcpy(pos_, data, len);
+            pos_ += len;
+        }
+        else
+        {
+            write_through(data, len);
+        }
+    }
+
+    void write(std::string_view str)
+    {
+        write(str.data(), str.size());
+    }
+
+    void write(char ch)
+    {
+        if (pos_ == end_)
+            flush();
+        *pos_++ = ch;
+    }
+
+    /**
+     * Hands everything written so far on to the destination.
+     */
+    void flush()
+    {
+        auto len = static_cast<std::size_t>(pos_ - buffer_.get());
+        pos_ = buffer_.get();
+        if (len > 0)
+            flush_buffer(buffer_.get(), len);
+    }
+
+  protected:
+    /**
+     * Writes out the contents of the buffer.
+     */
+    virtual void flush_buffer(const char* data, std::size_t len) = 0;
+
+    /**
+     * Writes out the contents of the buffer followed by a piece that was
+     * too large to be buffered. Sinks that can write both with one call
+     * override this.
+     */
+    virtual void flush_buffers(const char* data, std::size_t len,
+                               const char* more, std::size_t more_len)
+    {
+        if (len > 0)
+            flush_buffer(data, len);
+        flush_buffer(more, more_len);
+    }
+
+    /**
+     * Flushes from a destructor, where errors can't be reported.
+     */
+    void flush_quietly() noexcept
+    {
+        try
+        {
+            flush();
+        }
+        catch (...)
+        {
+            // nothing
+        }
+    }
+
+  private:
+    void write_through(const char* data, std::size_t len);
+
+    std::unique_ptr<char[]> buffer_;
+    char* pos_;
+    char* end_;
+};
+
+/**
+ * An output_sink that appends to a string.
+ */
+class string_sink : public output_sink
+{
+  public:
+    string_sink(std::string& str) : str_(str)
+    {
+        // nothing
+    }
+
+    ~string_sink() override
+    {
+        flush_quietly();
+    }
+
+  protected:
+    void flush_buffer(const char* data, std::size_t len) override
+    {
+        str_.append(data, len);
+    }
+
+  private:
+    std::string& str_;
+};
+
+/**
+ * An output_sink that writes to a stream.
+ */
+class ostream_sink : public output_sink
+{
+  public:
+    ostream_sink(std::ostream& stream) : stream_(stream)
     {
         // nothing
     }
-};
 
-template <class T, class... Ts>
-struct value_accept<T, Ts...>
-{
-    template <class Visitor, class... Args>
-    static void accept(const base& b, Visitor&& visitor, Args&&... args)
+    ~ostream_sink() override
     {
-        if (auto v = b.as<T>())
-        {
-            visitor.visit(*v, std::forward<Args>(args)...);
-        }
-        else
-        {
-            value_accept<Ts...>::accept(b, std::forward<Visitor>(visitor),
-                                        std::forward<Args>(args)...);
-        }
+        flush_quietly();
+    }
+
+  protected:
+    void flush_buffer(const char* data, std::size_t len) override
+    {
+        stream_.write(data, static_cast<std::streamsize>(len));
     }
+
+  private:
+    std::ostream& stream_;
 };
 
 /**
- * base implementation of accept() that calls visitor.visit() on the concrete
- * class.
+ * An output_sink that writes to a file descriptor, such as a socket or
+ * a file opened with open(). The descriptor is not closed.
+ *
+ * flush() throws std::system_error if the descriptor can't be written.
  */
-template <class Visitor, class... Args>
-void base::accept(Visitor&& visitor, Args&&... args) const
+class fd_sink : public output_sink
 {
-    if (is_value())
-    {
-        using value_acceptor
-            = value_accept<std::string, int64_t, double, bool, local_date,
-                           local_time, local_datetime, offset_datetime>;
-        value_acceptor::accept(*this, std::forward<Visitor>(visitor),
-                               std::forward<Args>(args)...);
-    }
-    else if (is_table())
-    {
-        visitor.visit(static_cast<const table&>(*this),
-                      std::forward<Args>(args)...);
-    }
-    else if (is_array())
+  public:
+    fd_sink(int fd) : fd_(fd)
     {
-        visitor.visit(static_cast<const array&>(*this),
-                      std::forward<Args>(args)...);
+        // nothing
     }
-    else if (is_table_array())
+
+    ~fd_sink() override
     {
-        visitor.visit(static_cast<const table_array&>(*this),
-                      std::forward<Args>(args)...);
+        flush_quietly();
     }
-}
+
+  protected:
+    void flush_buffer(const char* data, std::size_t len) override;
+
+    void flush_buffers(const char* data, std::size_t len, const char* more,
+                       std::size_t more_len) override;
+
+  private:
+    int fd_;
+};
 
 /**
  * Writer that can be passed to accept() functions of cpptoml objects and
- * will output valid TOML to a stream.
+ * will output valid TOML to a stream or an output_sink.
  */
 class toml_writer
 {
@@ -1584,11 +2758,50 @@ class toml_writer
      * Construct a toml_writer that will write to the given stream
      */
     toml_writer(std::ostream& s, const std::string& indent_space = "\t")
-        : stream_(s), indent_(indent_space), has_naked_endline_(false)
+        : owned_sink_(new ostream_sink(s)),
+          sink_(*owned_sink_),
+          indent_(indent_space),
+          has_naked_endline_(false)
+    {
+        // nothing
+    }
+
+    /**
+     * Construct a toml_writer that will write to the given sink. The sink
+     * is flushed whenever an object passed to accept() has been written.
+     */
+    toml_writer(output_sink& sink, const std::string& indent_space = "\t")
+        : sink_(sink), indent_(indent_space), has_naked_endline_(false)
     {
         // nothing
     }
 
+    /**
+     * Sets the number of threads large table arrays and tables are
+     * written on; 0 uses one per core. Runs of their entries are written
+     * to separate buffers at the same time and then appended in order, so
+     * the output is the same as with one thread.
+     */
+    void set_threads(unsigned threads);
+
+    /**
+     * Keeps the text written for every table but the outermost one, and
+     * writes it again as it is the next time the table is written under
+     * the same key, as long as nothing in it has been changed through the
+     * mutating members since. Writing a document again after a small
+     * change then only formats the tables on the path to the change.
+     *
+     * The text is kept with the tables, so this costs about as much memory
+     * as the output for each level of nesting, and a document must not be
+     * written by two caching writers at once. Tables are written on one
+     * thread while caching is on. Every element written this way gets a
+     * small block of bookkeeping, which base::mark_dirty() writes to.
+     */
+    void set_caching(bool enabled)
+    {
+        caching_ = enabled;
+    }
+
   public:
     /**
      * Output a base value of the TOML tree.
@@ -1596,7 +2809,12 @@ class toml_writer
     template <class T>
     void visit(const value<T>& v, bool = false)
     {
-        write(v);
+        if (v.verbatim_)
+            write(std::string_view{*v.lexeme_});
+        else
+            write(v);
+        if (depth_ == 0)
+            sink_.flush();
     }
 
     /**
@@ -1659,6 +2877,45 @@ class toml_writer
     void write_table_item_header(const base& b);
 
   private:
+    /**
+     * A key on the path to what is being written, and whether it can be
+     * written without quotes.
+     */
+    struct path_entry
+    {
+        const std::string* name;
+        bool bare;
+    };
+
+    /**
+     * Write out a table and everything in it.
+     */
+    void write_table(const table& t, bool in_array);
+
+    /**
+     * Write out a table, reusing the text cached for it when it is still
+     * current.
+     */
+    void write_cached(const table& t, bool in_array);
+
+    /**
+     * Record that child is being written in parent, so that a change to
+     * child reaches the tables cached around it.
+     */
+    void adopt(const base& child, const base& parent);
+
+    /**
+     * Write out a key of a table and the value, table or table array it
+     * holds.
+     */
+    void write_entry(const std::string& key, const base& b);
+
+    /**
+     * Write out a key, quoted if it has to be.
+     */
+    void write_key(const path_entry& key);
+    void write_key(std::string_view name, bool bare);
+
     /**
      * Indent the proper number of tabs given the size of
      * the path.
@@ -1666,27 +2923,333 @@ class toml_writer
     void indent();
 
     /**
-     * Write a value out to the stream.
+     * Write a value out to the sink.
      */
     void write(char ch);
 
-    template <class T>
-    void write(const T& v)
+    void write(const char* str)
     {
-        stream_ << v;
+        sink_.write(str, std::strlen(str));
+        has_naked_endline_ = false;
+    }
+
+    void write(const std::string& str)
+    {
+        sink_.write(str);
+        has_naked_endline_ = false;
+    }
+
+    void write(std::string_view str)
+    {
+        sink_.write(str.data(), str.size());
         has_naked_endline_ = false;
     }
 
     /**
-     * Write an endline out to the stream
+     * Write out a string with the characters escape_string() would escape
+     * escaped.
+     */
+    void write_escaped(std::string_view str);
+
+    void write(int64_t v);
+    void write(double v);
+    void write(const local_date& v);
+    void write(const local_time& v);
+    void write(const local_datetime& v);
+    void write(const offset_datetime& v);
+
+    /**
+     * Write an endline out to the sink
      */
     void endline();
 
+    /**
+     * Returns how many threads to write a run of count entries on.
+     */
+    unsigned threads_for(std::size_t count) const;
+
+    /**
+     * Writes entries [0, count) with write_entry(writer, i) on the given
+     * number of threads, each writing runs of entries to a buffer of its
+     * own. Every entry has to end with an endline.
+     */
+    template <class F>
+    void write_in_parallel(std::size_t count, unsigned threads,
+                           F write_entry);
+
   private:
-    std::ostream& stream_;
+    std::unique_ptr<output_sink> owned_sink_;
+    output_sink& sink_;
     const std::string indent_;
-    std::vector<std::string> path_;
+    std::vector<path_entry> path_;
     bool has_naked_endline_;
+    int depth_ = 0;
+    unsigned threads_ = 1;
+    bool caching_ = false;
+
+    // set when something this writer wrote is held by more than one
+    // container, so that the tables around it cannot be cached
+    bool uncacheable_ = false;
+
+    friend class toml_emitter;
+};
+
+/**
+ * Writes a TOML document piece by piece as it is produced, without
+ * building a table first, so that memory use does not grow with the size
+ * of the output. Values are escaped and formatted as toml_writer does.
+ *
+ * The calls have to come in an order that makes a valid document: the
+ * key/value pairs of a table come right after its header (or at the start,
+ * for the root table), and a table is not started twice. Arrays are
+ * opened with begin_array() and filled with value() calls or nested
+ * arrays; nothing else can be written until they are closed. finish()
+ * checks that they all were once the document is complete.
+ *
+ * \code
+ * toml_emitter out{std::cout};
+ * out.key_value("title", "export");
+ * for (const auto& row : rows)
+ * {
+ *     out.begin_table_array_entry({"records"});
+ *     out.key_value("id", row.id);
+ *     out.begin_array("tags");
+ *     for (const auto& tag : row.tags)
+ *         out.value(tag);
+ *     out.end_array();
+ * }
+ * out.finish();
+ * \endcode
+ */
+class toml_emitter
+{
+  public:
+    /**
+     * Construct a toml_emitter that writes to the given stream.
+     */
+    toml_emitter(std::ostream& stream) : writer_(stream)
+    {
+        // nothing
+    }
+
+    /**
+     * Construct a toml_emitter that writes to the given sink. Output is
+     * left in the sink's buffer until flush().
+     */
+    toml_emitter(output_sink& sink) : writer_(sink)
+    {
+        // nothing
+    }
+
+    /**
+     * Write out the header of the table with the given path, e.g.
+     * {"server", "tls"} for [server.tls].
+     */
+    void begin_table(std::initializer_list<std::string_view> path);
+    void begin_table(const std::vector<std::string>& path);
+
+    /**
+     * Write out the header of the next table in the table array with the
+     * given path, e.g. {"records"} for [[records]].
+     */
+    void begin_table_array_entry(std::initializer_list<std::string_view> path);
+    void begin_table_array_entry(const std::vector<std::string>& path);
+
+    /**
+     * Write out a key and its value. The value may be anything make_value()
+     * accepts.
+     */
+    template <class T>
+    void key_value(std::string_view key, T&& val)
+    {
+        begin_key(key);
+        write_value(std::forward<T>(val));
+        writer_.endline();
+    }
+
+    /**
+     * Start an array, either as the value of a key or, without a key, as
+     * the next element of the array that is open.
+     */
+    void begin_array(std::string_view key);
+    void begin_array();
+
+    /**
+     * Close the innermost array.
+     */
+    void end_array();
+
+    /**
+     * Write out the next element of the array that is open.
+     */
+    template <class T>
+    void value(T&& val)
+    {
+        begin_element();
+        write_value(std::forward<T>(val));
+    }
+
+    /**
+     * Hand everything written so far on to the stream or sink.
+     */
+    void flush()
+    {
+        writer_.sink_.flush();
+    }
+
+    /**
+     * Ends the document: checks that every array has been closed and
+     * hands everything on to the stream or sink.
+     * @throw std::logic_error if an array is still open
+     */
+    void finish();
+
+  private:
+    template <class T>
+    void write_value(T&& val)
+    {
+        if constexpr (std::is_convertible<T, std::string_view>::value)
+        {
+            write_string(val);
+        }
+        else
+        {
+            write_canonical(
+                value_traits<T>::construct(std::forward<T>(val)));
+        }
+    }
+
+    void write_canonical(const std::string& val)
+    {
+        write_string(val);
+    }
+
+    template <class T>
+    void write_canonical(const T& val)
+    {
+        writer_.write(val);
+    }
+
+    void write_canonical(bool val)
+    {
+        writer_.write(val ? "true" : "false");
+    }
+
+    void write_string(std::string_view val);
+    template <class Path>
+    void write_header(const Path& path, bool in_array);
+    void begin_key(std::string_view key);
+    void begin_element();
+
+    toml_writer writer_;
+
+    /**
+     * How many elements each open array has so far.
+     */
+    std::vector<std::size_t> arrays_;
+};
+
+/**
+ * The forms of JSON a json_writer can produce.
+ */
+enum class json_format
+{
+    /**
+     * Plain JSON: numbers and booleans as they are, dates and times as
+     * strings, and infinities and NaNs, which JSON can't represent, as
+     * null.
+     */
+    COMPACT,
+
+    /**
+     * The form the toml-test suite expects: every value is an object
+     * with its TOML type and its text, e.g.
+     * {"type":"integer","value":"42"}.
+     */
+    TYPED
+};
+
+/**
+ * Writer that can be passed to accept() functions of cpptoml objects and
+ * will output JSON to a stream or an output_sink. Tables become objects,
+ * and arrays and table arrays become arrays. Floats are written in the
+ * shortest form that reads back as the same double.
+ */
+class json_writer
+{
+  public:
+    /**
+     * Construct a json_writer that will write to the given stream.
+     */
+    json_writer(std::ostream& s, json_format format = json_format::COMPACT)
+        : owned_sink_(new ostream_sink(s)),
+          sink_(*owned_sink_),
+          format_(format)
+    {
+        // nothing
+    }
+
+    /**
+     * Construct a json_writer that will write to the given sink. The sink
+     * is flushed whenever an object passed to accept() has been written.
+     */
+    json_writer(output_sink& sink, json_format format = json_format::COMPACT)
+        : sink_(sink), format_(format)
+    {
+        // nothing
+    }
+
+    /**
+     * Output a base value of the TOML tree.
+     */
+    template <class T>
+    void visit(const value<T>& v, bool = false)
+    {
+        write(v.get());
+        if (depth_ == 0)
+            sink_.flush();
+    }
+
+    /**
+     * Output a table element of the TOML tree.
+     */
+    void visit(const table& t, bool = false);
+
+    /**
+     * Output an array element of the TOML tree.
+     */
+    void visit(const array& a, bool = false);
+
+    /**
+     * Output a table_array element of the TOML tree.
+     */
+    void visit(const table_array& t, bool = false);
+
+  private:
+    void write(const std::string& v);
+    void write(int64_t v);
+    void write(double v);
+    void write(bool v);
+    void write(const local_date& v);
+    void write(const local_time& v);
+    void write(const local_datetime& v);
+    void write(const offset_datetime& v);
+
+    /**
+     * Write out a quoted, escaped string.
+     */
+    void write_string(std::string_view str);
+
+    /**
+     * Write out a value, as is or as {"type":...,"value":"..."} in the
+     * typed format.
+     */
+    void write_value(const char* type, std::string_view text, bool quoted);
+
+    std::unique_ptr<output_sink> owned_sink_;
+    output_sink& sink_;
+    json_format format_;
+    int depth_ = 0;
 };
 
 inline std::ostream& operator<<(std::ostream& stream, const base& b)
@@ -1724,6 +3287,19 @@ inline std::ostream& operator<<(std::ostream& stream, const array& a)
     a.accept(writer);
     return stream;
 }
+
+/**
+ * Writes a table out to the end of str. The output is first written to
+ * pieces that are never moved, and str then grows once, to exactly the
+ * size it ends up with, so large documents are not copied over and over
+ * as the string grows.
+ */
+void serialize_into(std::string& str, const table& t);
+
+/**
+ * Writes a table out to a string of exactly the right size.
+ */
+std::string to_string(const table& t);
 } // namespace cpptomlng
 
 #ifndef CPPTOMLNG_NO_ALIAS
@@ -1,7 +1,28 @@
 #include "cpptoml.h"
 
-#include <iomanip>
+#include <atomic>
+#include <cerrno>
+#include <charconv>
+#include <cstring>
 #include <fstream>
+#include <system_error>
+#include <thread>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define CPPTOMLNG_HAVE_UNISTD 1
+#endif
+
+// set by the build when the io_uring option is enabled
+#if defined(CPPTOMLNG_HAVE_IO_URING) && defined(__linux__)
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#else
+#undef CPPTOMLNG_HAVE_IO_URING
+#endif
 
 namespace cpptomlng
 {
@@ -45,89 +66,675 @@ fill_guard::~fill_guard()
     os_.fill(fill_);
 }
 
-std::ostream& operator<<(std::ostream& os, const local_date& dt)
+namespace detail
+{
+/**
+ * "00" to "99", so that two digits can be copied at once.
+ */
+static const char digit_pairs[] = "00010203040506070809"
+                                  "10111213141516171819"
+                                  "20212223242526272829"
+                                  "30313233343536373839"
+                                  "40414243444546474849"
+                                  "50515253545556575859"
+                                  "60616263646566676869"
+                                  "70717273747576777879"
+                                  "80818283848586878889"
+                                  "90919293949596979899";
+
+static char* write_pair(char* out, int v)
 {
-    fill_guard g{os};
-    os.fill('0');
+    std::memcpy(out, digit_pairs + 2 * v, 2);
+    return out + 2;
+}
 
-    using std::setw;
-    os << setw(4) << dt.year << "-" << setw(2) << dt.month << "-" << setw(2)
-       << dt.day;
+/**
+ * Writes v padded with zeros to width digits, as setw() with a fill of
+ * '0' does.
+ */
+static char* write_padded(char* out, int v, int width)
+{
+    if (width == 2 && v >= 0 && v < 100)
+        return write_pair(out, v);
+    if (width == 4 && v >= 0 && v < 10000)
+        return write_pair(write_pair(out, v / 100), v % 100);
 
-    return os;
+    // out of range for the field; the padding goes in front of any sign
+    char buf[16];
+    auto end = std::to_chars(buf, buf + sizeof(buf), v).ptr;
+    auto len = static_cast<int>(end - buf);
+    for (; len < width; --width)
+        *out++ = '0';
+    std::memcpy(out, buf, static_cast<std::size_t>(len));
+    return out + len;
 }
 
-std::ostream& operator<<(std::ostream& os, const local_time& ltime)
+char* format_datetime(char* out, const local_date& dt)
 {
-    fill_guard g{os};
-    os.fill('0');
+    out = write_padded(out, dt.year, 4);
+    *out++ = '-';
+    out = write_padded(out, dt.month, 2);
+    *out++ = '-';
+    return write_padded(out, dt.day, 2);
+}
 
-    using std::setw;
-    os << setw(2) << ltime.hour << ":" << setw(2) << ltime.minute << ":"
-       << setw(2) << ltime.second;
+char* format_datetime(char* out, const local_time& ltime)
+{
+    out = write_padded(out, ltime.hour, 2);
+    *out++ = ':';
+    out = write_padded(out, ltime.minute, 2);
+    *out++ = ':';
+    out = write_padded(out, ltime.second, 2);
 
     if (ltime.microsecond > 0)
     {
-        os << ".";
-        int power = 100000;
-        for (int curr_us = ltime.microsecond; curr_us; power /= 10)
+        // the first digit (or more, if there are more than six), then the
+        // other five without trailing zeros
+        *out++ = '.';
+        out = std::to_chars(out, out + 16, ltime.microsecond / 100000).ptr;
+        int rest = ltime.microsecond % 100000;
+        if (rest > 0)
         {
-            auto num = curr_us / power;
-            os << num;
-            curr_us -= num * power;
+            char digits[6];
+            *digits = static_cast<char>('0' + rest / 10000);
+            write_pair(write_pair(digits + 1, rest / 100 % 100), rest % 100);
+            int len = 5;
+            while (digits[len - 1] == '0')
+                --len;
+            std::memcpy(out, digits, static_cast<std::size_t>(len));
+            out += len;
         }
     }
+    return out;
+}
 
-    return os;
+char* format_datetime(char* out, const zone_offset& zo)
+{
+    if (zo.hour_offset != 0 || zo.minute_offset != 0)
+    {
+        *out++ = zo.hour_offset > 0 ? '+' : '-';
+        out = write_padded(out, std::abs(zo.hour_offset), 2);
+        *out++ = ':';
+        return write_padded(out, std::abs(zo.minute_offset), 2);
+    }
+
+    *out++ = 'Z';
+    return out;
+}
+
+char* format_datetime(char* out, const local_datetime& dt)
+{
+    out = format_datetime(out, static_cast<const local_date&>(dt));
+    *out++ = 'T';
+    return format_datetime(out, static_cast<const local_time&>(dt));
+}
+
+char* format_datetime(char* out, const offset_datetime& dt)
+{
+    out = format_datetime(out, static_cast<const local_datetime&>(dt));
+    return format_datetime(out, static_cast<const zone_offset&>(dt));
+}
+
+template <class T>
+static std::ostream& write_datetime(std::ostream& os, const T& dt)
+{
+    char buf[datetime_buffer_size];
+    auto end = format_datetime(buf, dt);
+    return os.write(buf, end - buf);
+}
+} // namespace detail
+
+std::ostream& operator<<(std::ostream& os, const local_date& dt)
+{
+    return detail::write_datetime(os, dt);
+}
+
+std::ostream& operator<<(std::ostream& os, const local_time& ltime)
+{
+    return detail::write_datetime(os, ltime);
 }
 
 std::ostream& operator<<(std::ostream& os, const local_datetime& dt)
 {
-    return os << static_cast<const local_date&>(dt) << "T"
-              << static_cast<const local_time&>(dt);
+    return detail::write_datetime(os, dt);
 }
 
 std::ostream& operator<<(std::ostream& os, const offset_datetime& dt)
 {
-    return os << static_cast<const local_datetime&>(dt)
-              << static_cast<const zone_offset&>(dt);
+    return detail::write_datetime(os, dt);
 }
 
 std::ostream& operator<<(std::ostream& os, const zone_offset& zo)
 {
-    fill_guard g{os};
-    os.fill('0');
+    return detail::write_datetime(os, zo);
+}
 
-    using std::setw;
+std::shared_ptr<table> parse_file(const std::string& filename,
+                                  const parse_options& options)
+{
+    std::ifstream file{filename};
+    if (!file.is_open())
+        throw parse_exception{filename + " could not be opened for parsing"};
+    parser p{file, options};
+    return p.parse();
+}
 
-    if (zo.hour_offset != 0 || zo.minute_offset != 0)
+namespace detail
+{
+/**
+ * Reads whole files into memory, a batch at a time. With io_uring, the
+ * opens, reads and closes of a batch are each handed to the kernel in one
+ * system call. Without it, or if the kernel lacks any of the operations,
+ * each file is opened and read on its own.
+ */
+class file_loader
+{
+  public:
+    static constexpr std::size_t batch_size = 32;
+
+    file_loader()
+    {
+#ifdef CPPTOMLNG_HAVE_IO_URING
+        if (!setup_ring())
+            close_ring();
+#endif
+    }
+
+    ~file_loader()
+    {
+#ifdef CPPTOMLNG_HAVE_IO_URING
+        close_ring();
+#endif
+    }
+
+    file_loader(const file_loader&) = delete;
+    file_loader& operator=(const file_loader&) = delete;
+
+    /**
+     * Reads up to batch_size files. Every file gets either its contents
+     * or a message saying why it could not be read.
+     */
+    void load(const std::string* names, std::size_t count,
+              std::string* contents, std::string* errors)
+    {
+#ifdef CPPTOMLNG_HAVE_IO_URING
+        if (ring_fd_ >= 0)
+        {
+            try
+            {
+                load_batch(names, count, contents, errors);
+                return;
+            }
+            catch (const std::system_error&)
+            {
+                // the ring is unusable, so read this and later batches
+                // without it. A file the kernel may still be working on
+                // is left alone, and so is the buffer it reads into
+                close_ring();
+                for (std::size_t i = 0; i < count; ++i)
+                {
+                    const auto& file = files_[i];
+                    if (file.busy)
+                    {
+                        abandoned_.push_back(std::move(contents[i]));
+                        errors[i] = cannot_read(names[i]);
+                        continue;
+                    }
+
+                    if (file.fd >= 0)
+                        close(file.fd);
+                    errors[i] = load_one(names[i], contents[i]);
+                }
+                return;
+            }
+        }
+#endif
+        for (std::size_t i = 0; i < count; ++i)
+            errors[i] = load_one(names[i], contents[i]);
+    }
+
+  private:
+    static std::string cannot_open(const std::string& name)
+    {
+        return name + " could not be opened for parsing";
+    }
+
+    static std::string cannot_read(const std::string& name)
+    {
+        return name + " could not be read";
+    }
+
+#ifdef CPPTOMLNG_HAVE_UNISTD
+    /**
+     * Reads the rest of an open file. Files that don't know their size,
+     * like pipes, are read until they end, so this reads rather than
+     * preads.
+     */
+    static bool read_all(int fd, std::string& contents)
+    {
+        struct stat st;
+        std::size_t size = 0;
+        if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode))
+            size = static_cast<std::size_t>(st.st_size);
+
+        // one more byte than needed, so that hitting the end of the file
+        // doesn't look like the buffer filling up
+        std::size_t filled = 0;
+        contents.resize(std::max<std::size_t>(size + 1, 4096));
+        for (;;)
+        {
+            if (filled == contents.size())
+                contents.resize(contents.size() * 2);
+
+            auto n = read(fd, &contents[filled], contents.size() - filled);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n < 0)
+                return false;
+            if (n == 0)
+                break;
+            filled += static_cast<std::size_t>(n);
+        }
+        contents.resize(filled);
+        return true;
+    }
+
+    static std::string load_one(const std::string& name,
+                                std::string& contents)
+    {
+        int fd = open(name.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+            return cannot_open(name);
+
+        bool complete = read_all(fd, contents);
+        close(fd);
+        return complete ? std::string{} : cannot_read(name);
+    }
+#else
+    static std::string load_one(const std::string& name,
+                                std::string& contents)
+    {
+        std::ifstream file{name, std::ios::binary};
+        if (!file.is_open())
+            return cannot_open(name);
+
+        contents.assign(std::istreambuf_iterator<char>{file},
+                        std::istreambuf_iterator<char>{});
+        return file.bad() ? cannot_read(name) : std::string{};
+    }
+#endif
+
+#ifdef CPPTOMLNG_HAVE_IO_URING
+    /**
+     * What is known about one file of the batch being loaded.
+     */
+    struct file_state
     {
-        if (zo.hour_offset > 0)
+        int fd;
+        std::size_t filled;
+        bool done;
+
+        // whether an operation on the file has been queued and has not
+        // completed yet
+        bool busy;
+    };
+
+    bool setup_ring()
+    {
+        io_uring_params params;
+        std::memset(&params, 0, sizeof(params));
+        ring_fd_ = static_cast<int>(
+            syscall(__NR_io_uring_setup, batch_size, &params));
+        if (ring_fd_ < 0)
+            return false;
+
+        // the batches need all of these and reads from the current file
+        // position, which came with linux 5.6
+        if (!(params.features & IORING_FEAT_RW_CUR_POS))
+            return false;
+        std::vector<char> buffer(sizeof(io_uring_probe)
+                                 + 256 * sizeof(io_uring_probe_op));
+        auto probe = reinterpret_cast<io_uring_probe*>(buffer.data());
+        if (syscall(__NR_io_uring_register, ring_fd_, IORING_REGISTER_PROBE,
+                    probe, 256)
+            < 0)
+            return false;
+        for (int op : {IORING_OP_OPENAT, IORING_OP_READ, IORING_OP_CLOSE})
         {
-            os << "+";
+            if (op > probe->last_op
+                || !(probe->ops[op].flags & IO_URING_OP_SUPPORTED))
+                return false;
+        }
+
+        sq_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cq_size_ = params.cq_off.cqes
+                   + params.cq_entries * sizeof(io_uring_cqe);
+        if (params.features & IORING_FEAT_SINGLE_MMAP)
+            sq_size_ = cq_size_ = std::max(sq_size_, cq_size_);
+
+        sq_ptr_ = mmap(nullptr, sq_size_, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQ_RING);
+        if (sq_ptr_ == MAP_FAILED)
+            return false;
+        if (params.features & IORING_FEAT_SINGLE_MMAP)
+        {
+            cq_ptr_ = sq_ptr_;
         }
         else
         {
-            os << "-";
+            cq_ptr_ = mmap(nullptr, cq_size_, PROT_READ | PROT_WRITE,
+                           MAP_SHARED | MAP_POPULATE, ring_fd_,
+                           IORING_OFF_CQ_RING);
+            if (cq_ptr_ == MAP_FAILED)
+                return false;
         }
-        os << setw(2) << std::abs(zo.hour_offset) << ":" << setw(2)
-           << std::abs(zo.minute_offset);
+
+        sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+        auto sqes = mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE, ring_fd_,
+                         IORING_OFF_SQES);
+        if (sqes == MAP_FAILED)
+            return false;
+        sqes_ = static_cast<io_uring_sqe*>(sqes);
+
+        auto sq = static_cast<char*>(sq_ptr_);
+        sq_tail_ = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+        sq_mask_ = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+        sq_array_ = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+
+        auto cq = static_cast<char*>(cq_ptr_);
+        cq_head_ = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+        cq_tail_ = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+        cq_mask_ = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+        cqes_ = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+        return true;
     }
-    else
+
+    void close_ring()
     {
-        os << "Z";
+        if (sqes_)
+            munmap(sqes_, sqes_size_);
+        if (cq_ptr_ && cq_ptr_ != MAP_FAILED && cq_ptr_ != sq_ptr_)
+            munmap(cq_ptr_, cq_size_);
+        if (sq_ptr_ && sq_ptr_ != MAP_FAILED)
+            munmap(sq_ptr_, sq_size_);
+        if (ring_fd_ >= 0)
+            close(ring_fd_);
+        sqes_ = nullptr;
+        cq_ptr_ = sq_ptr_ = nullptr;
+        ring_fd_ = -1;
     }
 
-    return os;
-}
+    /**
+     * Queues an operation; nothing is sent to the kernel until submit().
+     */
+    io_uring_sqe& queue(std::uint8_t opcode, int fd, std::uint64_t user_data)
+    {
+        auto index = (*sq_tail_ + queued_) & sq_mask_;
+        ++queued_;
+        auto& sqe = sqes_[index];
+        std::memset(&sqe, 0, sizeof(sqe));
+        sqe.opcode = opcode;
+        sqe.fd = fd;
+        sqe.user_data = user_data;
+        sq_array_[index] = index;
+        files_[user_data].busy = true;
+        return sqe;
+    }
+
+    /**
+     * Sends every queued operation to the kernel and hands each result
+     * to on_complete(user_data, result) once they have all finished.
+     *
+     * If the kernel refuses them, the operations it has not taken yet are
+     * taken back and those it has are waited for before throwing, so that
+     * only the files still marked busy are in an unknown state.
+     */
+    template <class Callback>
+    void submit(Callback&& on_complete)
+    {
+        auto pending = queued_;
+        __atomic_store_n(sq_tail_, *sq_tail_ + queued_, __ATOMIC_RELEASE);
+        queued_ = 0;
+
+        auto to_submit = pending;
+        while (pending > 0)
+        {
+            auto done = syscall(__NR_io_uring_enter, ring_fd_, to_submit,
+                                pending, IORING_ENTER_GETEVENTS, nullptr, 0);
+            if (done < 0 && errno != EINTR && errno != EAGAIN
+                && errno != EBUSY)
+            {
+                auto error = errno;
+                withdraw(to_submit);
+                drain(pending - to_submit, on_complete);
+                throw std::system_error{error, std::generic_category(),
+                                        "io_uring_enter"};
+            }
+            if (done > 0)
+                to_submit -= static_cast<unsigned>(done);
+
+            pending -= reap(on_complete);
+        }
+    }
+
+    /**
+     * Hands the results that have arrived to on_complete() and returns
+     * how many there were.
+     */
+    template <class Callback>
+    unsigned reap(Callback& on_complete)
+    {
+        unsigned count = 0;
+        auto head = *cq_head_;
+        auto tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+        for (; head != tail; ++head, ++count)
+        {
+            const auto& cqe = cqes_[head & cq_mask_];
+            files_[cqe.user_data].busy = false;
+            on_complete(cqe.user_data, cqe.res);
+        }
+        __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+        return count;
+    }
 
-std::shared_ptr<table> parse_file(const std::string& filename)
+    /**
+     * Takes back the last count queued operations, which the kernel has
+     * not looked at. It only reads the queue in io_uring_enter, so the
+     * tail can be moved back.
+     */
+    void withdraw(unsigned count)
+    {
+        auto tail = *sq_tail_;
+        for (auto i = tail - count; i != tail; ++i)
+            files_[sqes_[sq_array_[i & sq_mask_]].user_data].busy = false;
+        __atomic_store_n(sq_tail_, tail - count, __ATOMIC_RELEASE);
+    }
+
+    /**
+     * Waits for the operations the kernel has taken to finish, as far as
+     * it still answers.
+     */
+    template <class Callback>
+    void drain(unsigned in_flight, Callback& on_complete)
+    {
+        while (in_flight > 0)
+        {
+            auto done = syscall(__NR_io_uring_enter, ring_fd_, 0, in_flight,
+                                IORING_ENTER_GETEVENTS, nullptr, 0);
+            if (done < 0 && errno != EINTR && errno != EAGAIN
+                && errno != EBUSY)
+                return;
+            in_flight -= reap(on_complete);
+        }
+    }
+
+    void load_batch(const std::string* names, std::size_t count,
+                    std::string* contents, std::string* errors)
+    {
+        files_.assign(count, file_state{-1, 0, true, false});
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            auto& opening = queue(IORING_OP_OPENAT, AT_FDCWD, i);
+            opening.addr = reinterpret_cast<std::uint64_t>(names[i].c_str());
+            opening.open_flags = O_RDONLY | O_CLOEXEC;
+        }
+        submit([&](std::uint64_t i, int result) { files_[i].fd = result; });
+
+        // asking for the size would cost more than the reads it saves, so
+        // read into what the buffer held last time until the file ends
+        std::size_t reading = 0;
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            auto& file = files_[i];
+            file.filled = 0;
+            file.done = file.fd < 0;
+            if (file.done)
+            {
+                errors[i] = cannot_open(names[i]);
+                continue;
+            }
+
+            errors[i].clear();
+            contents[i].resize(std::max<std::size_t>(contents[i].capacity(),
+                                                     16384));
+            ++reading;
+        }
+        while (reading > 0)
+        {
+            for (std::size_t i = 0; i < count; ++i)
+            {
+                auto& file = files_[i];
+                if (file.done)
+                    continue;
+                if (file.filled == contents[i].size())
+                    contents[i].resize(contents[i].size() * 2);
+
+                // read from where the last read left off, which also works
+                // for pipes
+                auto& request = queue(IORING_OP_READ, file.fd, i);
+                request.addr = reinterpret_cast<std::uint64_t>(
+                    &contents[i][file.filled]);
+                request.len = static_cast<std::uint32_t>(
+                    std::min<std::size_t>(contents[i].size() - file.filled,
+                                          1u << 30));
+                request.off = static_cast<std::uint64_t>(-1);
+            }
+            submit([&](std::uint64_t i, int result) {
+                auto& file = files_[i];
+                if (result == -EINTR || result == -EAGAIN)
+                    return;
+
+                if (result < 0)
+                    errors[i] = cannot_read(names[i]);
+                else if (result == 0)
+                    contents[i].resize(file.filled);
+                file.filled += static_cast<std::size_t>(std::max(result, 0));
+                file.done = result <= 0;
+                if (file.done)
+                    --reading;
+            });
+        }
+
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            if (files_[i].fd >= 0)
+                queue(IORING_OP_CLOSE, files_[i].fd, i);
+        }
+        submit([&](std::uint64_t i, int) { files_[i].fd = -1; });
+    }
+
+    int ring_fd_ = -1;
+    void* sq_ptr_ = nullptr;
+    void* cq_ptr_ = nullptr;
+    io_uring_sqe* sqes_ = nullptr;
+    std::size_t sq_size_ = 0;
+    std::size_t cq_size_ = 0;
+    std::size_t sqes_size_ = 0;
+    unsigned* sq_tail_ = nullptr;
+    unsigned* sq_array_ = nullptr;
+    unsigned sq_mask_ = 0;
+    unsigned queued_ = 0;
+    unsigned* cq_head_ = nullptr;
+    unsigned* cq_tail_ = nullptr;
+    unsigned cq_mask_ = 0;
+    io_uring_cqe* cqes_ = nullptr;
+    std::vector<file_state> files_;
+
+    // buffers the kernel may still have been reading into when the ring
+    // failed, kept so that their memory is never reused
+    std::vector<std::string> abandoned_;
+#endif
+};
+} // namespace detail
+
+std::vector<file_parse_result>
+parse_files(const std::vector<std::string>& filenames,
+            const parse_options& options)
 {
-    std::ifstream file{filename};
-    if (!file.is_open())
-        throw parse_exception{filename + " could not be opened for parsing"};
-    parser p{file};
-    return p.parse();
+    std::vector<file_parse_result> results(filenames.size());
+
+    // the files are already spread over the threads
+    auto file_options = options;
+    file_options.threads = 1;
+
+    auto threads = options.threads;
+    if (threads == 0)
+        threads = std::max(std::thread::hardware_concurrency(), 1u);
+    threads = static_cast<unsigned>(
+        std::min<std::size_t>(threads, filenames.size()));
+
+    // small enough batches that every thread gets a few of them
+    auto batch = std::min(detail::file_loader::batch_size,
+                          std::max<std::size_t>(
+                              filenames.size() / (4 * threads + 1), 1));
+
+    std::atomic<std::size_t> next{0};
+    auto work = [&]() {
+        // the buffers of a thread, the parser's included, are reused for
+        // all of its files
+        detail::file_loader loader;
+        std::vector<std::string> contents(batch);
+        std::vector<std::string> errors(batch);
+        parser p{nullptr, 0, file_options};
+
+        std::size_t first;
+        while ((first = next.fetch_add(batch)) < filenames.size())
+        {
+            auto count = std::min(batch, filenames.size() - first);
+            loader.load(&filenames[first], count, contents.data(),
+                        errors.data());
+
+            for (std::size_t i = 0; i < count; ++i)
+            {
+                auto& result = results[first + i];
+                if (!errors[i].empty())
+                {
+                    result.error = std::move(errors[i]);
+                    continue;
+                }
+
+                try
+                {
+                    p.reset(contents[i].data(), contents[i].size());
+                    result.root = p.parse();
+                }
+                catch (const std::exception& e)
+                {
+                    result.error = e.what();
+                }
+            }
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (unsigned i = 1; i < threads; ++i)
+        workers.emplace_back(work);
+    work();
+    for (auto& worker : workers)
+        worker.join();
+
+    return results;
 }
 
 
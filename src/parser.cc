@@ -1,7 +1,19 @@
 #include "cpptoml.h"
 
-#include <sstream>
+#include <atomic>
+#include <clocale>
+#include <condition_variable>
+#include <cstring>
 #include <cassert>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <unordered_set>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define CPPTOMLNG_HAVE_SSE2 1
+#endif
 
 namespace cpptomlng
 {
@@ -115,350 +127,888 @@ consumer<OnError> make_consumer(std::string::iterator& it,
 {
     return consumer<OnError>(it, end, std::forward<OnError>(on_error));
 }
-} // namespace detail
 
-std::shared_ptr<table> parser::parse()
+struct hex_digit_table
 {
-    std::shared_ptr<table> root = make_table();
+    constexpr hex_digit_table() : values{}
+    {
+        for (auto& v : values)
+            v = 0xff;
+        for (int c = '0'; c <= '9'; ++c)
+            values[c] = static_cast<uint8_t>(c - '0');
+        for (int c = 'a'; c <= 'f'; ++c)
+            values[c] = static_cast<uint8_t>(10 + c - 'a');
+        for (int c = 'A'; c <= 'F'; ++c)
+            values[c] = static_cast<uint8_t>(10 + c - 'A');
+    }
+
+    constexpr uint8_t operator[](unsigned char c) const
+    {
+        return values[c];
+    }
 
-    table* curr_table = root.get();
+    uint8_t values[256];
+};
+
+/**
+ * Maps a character to its hexadecimal digit value, or to 0xff if it is
+ * not a hexadecimal digit.
+ */
+constexpr hex_digit_table hex_table{};
 
-    while (detail::getline(input_, line_))
+struct escape_code_table
+{
+    constexpr escape_code_table() : values{}
     {
-        line_number_++;
-        auto it = line_.begin();
-        auto end = line_.end();
-        consume_whitespace(it, end);
-        if (it == end || *it == '#')
-            continue;
-        if (*it == '[')
-        {
-            curr_table = root.get();
-            parse_table(it, end, curr_table);
-        }
-        else
-        {
-            parse_key_value(it, end, curr_table);
-            consume_whitespace(it, end);
-            eol_or_comment(it, end);
-        }
+        values['b'] = '\b';
+        values['t'] = '\t';
+        values['n'] = '\n';
+        values['f'] = '\f';
+        values['r'] = '\r';
+        values['"'] = '"';
+        values['\\'] = '\\';
     }
-    return root;
+
+    constexpr char operator[](unsigned char c) const
+    {
+        return values[c];
+    }
+
+    char values[256];
+};
+
+/**
+ * Maps the character following a backslash to the character it stands
+ * for, or to '\0' if it is not a single-character escape.
+ */
+constexpr escape_code_table escape_table{};
+
+/**
+ * Loads eight characters into a word such that the first character lands
+ * in the lowest byte, independent of the host byte order.
+ */
+inline uint64_t load_le64(const char* p)
+{
+    uint64_t word = 0;
+    for (int i = 0; i < 8; ++i)
+        word |= static_cast<uint64_t>(static_cast<unsigned char>(p[i]))
+                << (8 * i);
+    return word;
 }
 
-void parser::parse_table(std::string::iterator& it,
-                 const std::string::iterator& end, table*& curr_table)
+/**
+ * Checks eight characters loaded with load_le64 against a fixed layout of
+ * digits and separators. Bytes set in digit_slots must be decimal digits;
+ * all other bytes must equal the corresponding byte of separators. On
+ * success, returns true and stores the word with every digit replaced by
+ * its value (and every separator by zero) in digits.
+ */
+inline bool match_layout(uint64_t word, uint64_t digit_slots,
+                         uint64_t separators, uint64_t& digits)
 {
-    // remove the beginning keytable marker
-    ++it;
-    if (it == end)
-        throw_parse_exception("Unexpected end of table");
-    if (*it == '[')
-        parse_table_array(it, end, curr_table);
-    else
-        parse_single_table(it, end, curr_table);
+    const uint64_t zeros = UINT64_C(0x3030303030303030) & digit_slots;
+    const uint64_t high_nibbles = UINT64_C(0xf0f0f0f0f0f0f0f0) & digit_slots;
+
+    auto t = word ^ (zeros | separators);
+    if ((t & ~digit_slots) != 0)
+        return false;
+
+    // a digit slot is valid when its high nibble is clear and adding 6
+    // does not carry into it (i.e. the low nibble is at most 9)
+    if (((t | (t + UINT64_C(0x0606060606060606))) & high_nibbles) != 0)
+        return false;
+
+    digits = t;
+    return true;
 }
 
-void parser::parse_single_table(std::string::iterator& it,
-                        const std::string::iterator& end,
-                        table*& curr_table)
+/**
+ * Combines every pair of adjacent digits produced by match_layout into a
+ * two-digit number stored in the byte of the first digit of the pair.
+ */
+inline uint64_t combine_digit_pairs(uint64_t digits)
 {
-    if (it == end || *it == ']')
-        throw_parse_exception("Table name cannot be empty");
+    return digits * 10 + (digits >> 8);
+}
 
-    std::string full_table_name;
-    bool inserted = false;
+inline int pair_at(uint64_t pairs, int byte)
+{
+    return static_cast<int>((pairs >> (8 * byte)) & 0xff);
+}
 
-    auto key_end = [](char c) { return c == ']'; };
+// "YYYY-MM-", "YY-MM-DD" and "HH:MM:SS"
+constexpr uint64_t year_month_digits = UINT64_C(0x00ffff00ffffffff);
+constexpr uint64_t year_month_separators = UINT64_C(0x2d00002d00000000);
+constexpr uint64_t month_day_digits = UINT64_C(0xffff00ffff00ffff);
+constexpr uint64_t month_day_separators = UINT64_C(0x00002d00002d0000);
+constexpr uint64_t time_digits = UINT64_C(0xffff00ffff00ffff);
+constexpr uint64_t time_separators = UINT64_C(0x00003a00003a0000);
 
-    auto key_part_handler = [&](const std::string& part) {
-        if (part.empty())
-            throw_parse_exception("Empty component of table name");
+inline bool is_date_char(char c)
+{
+    return is_number(c) || c == 'T' || c == 'Z' || c == ':' || c == '-'
+           || c == '+' || c == '.';
+}
 
-        if (!full_table_name.empty())
-            full_table_name += '.';
-        full_table_name += part;
+inline bool is_time_char(char c)
+{
+    return is_number(c) || c == ':' || c == '.';
+}
 
-        if (curr_table->contains(part))
-        {
-#if !defined(__PGI)
-            auto b = curr_table->get(part);
-#else
-            // Workaround for PGI compiler
-            std::shared_ptr<base> b = curr_table->get(part);
-#endif
-            if (b->is_table())
-                curr_table = static_cast<table*>(b.get());
-            else if (b->is_table_array())
-                curr_table = std::static_pointer_cast<table_array>(b)
-                                 ->get()
-                                 .back()
-                                 .get();
-            else
-                throw_parse_exception("Key " + full_table_name
-                                      + "already exists as a value");
-        }
-        else
+/**
+ * Decodes "HH:MM:SS" followed by an optional fraction. Returns a pointer
+ * past the parsed characters, or nullptr if the input does not have that
+ * exact shape. At least eight characters must be readable at p.
+ */
+inline const char* parse_time_fast(const char* p, const char* end,
+                                   local_time& ltime)
+{
+    uint64_t digits;
+    if (!match_layout(load_le64(p), time_digits, time_separators, digits))
+        return nullptr;
+
+    auto pairs = combine_digit_pairs(digits);
+    ltime.hour = pair_at(pairs, 0);
+    ltime.minute = pair_at(pairs, 3);
+    ltime.second = pair_at(pairs, 6);
+    ltime.microsecond = 0;
+    p += 8;
+
+    if (p != end && *p == '.')
+    {
+        ++p;
+        if (p == end || !is_number(*p))
+            return nullptr;
+
+        int power = 100000;
+        while (p != end && is_number(*p))
         {
-            inserted = true;
-            curr_table->insert(part, make_table());
-            curr_table = static_cast<table*>(curr_table->get(part).get());
+            ltime.microsecond += power * (*p++ - '0');
+            power /= 10;
         }
-    };
-
-    key_part_handler(parse_key(it, end, key_end, key_part_handler));
+    }
 
-    if (it == end)
-        throw_parse_exception(
-            "Unterminated table declaration; did you forget a ']'?");
+    return p;
+}
 
-    if (*it != ']')
+struct structural_char_table
+{
+    constexpr structural_char_table() : values{}
     {
-        std::string errmsg{"Unexpected character in table definition: "};
-        errmsg += '"';
-        errmsg += *it;
-        errmsg += '"';
-        throw_parse_exception(errmsg);
+        for (auto c : "\n\"'\\#[]{},=")
+            values[static_cast<unsigned char>(c)] = c != '\0';
     }
 
-    // table already existed
-    if (!inserted)
+    constexpr bool operator[](unsigned char c) const
     {
-        auto is_value
-            = [](const std::pair<const std::string&,
-                                 const std::shared_ptr<base>&>& p) {
-                  return p.second->is_value();
-              };
+        return values[c];
+    }
+
+    bool values[256];
+};
+
+/**
+ * Tells whether a character is one the structural index has to look at:
+ * newlines, quotes, backslashes, comment starts, brackets, commas and
+ * equals signs.
+ */
+constexpr structural_char_table structural_chars{};
 
-        // if there are any values, we can't add values to this table
-        // since it has already been defined. If there aren't any
-        // values, then it was implicitly created by something like
-        // [a.b]
-        if (curr_table->empty()
-            || std::any_of(curr_table->begin(), curr_table->end(),
-                           is_value))
+/**
+ * Returns a mask with bit i set if p[i] is a structural character, for
+ * the first n (at most 64) characters at p.
+ */
+inline uint64_t structural_bits(const char* p, std::size_t n)
+{
+#ifdef CPPTOMLNG_HAVE_SSE2
+    if (n == 64)
+    {
+        uint64_t bits = 0;
+        for (int i = 0; i < 4; ++i)
         {
-            throw_parse_exception("Redefinition of table "
-                                  + full_table_name);
+            auto v = _mm_loadu_si128(
+                reinterpret_cast<const __m128i*>(p + 16 * i));
+            auto m = _mm_or_si128(
+                _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\n')),
+                             _mm_cmpeq_epi8(v, _mm_set1_epi8('"'))),
+                _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\'')),
+                             _mm_cmpeq_epi8(v, _mm_set1_epi8('\\'))));
+            m = _mm_or_si128(
+                m, _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('#')),
+                                _mm_cmpeq_epi8(v, _mm_set1_epi8(','))));
+            m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('=')));
+            m = _mm_or_si128(
+                m, _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('[')),
+                                _mm_cmpeq_epi8(v, _mm_set1_epi8(']'))));
+            m = _mm_or_si128(
+                m, _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('{')),
+                                _mm_cmpeq_epi8(v, _mm_set1_epi8('}'))));
+            bits |= static_cast<uint64_t>(static_cast<uint16_t>(
+                        _mm_movemask_epi8(m)))
+                    << (16 * i);
         }
+        return bits;
     }
+#endif
 
-    ++it;
-    consume_whitespace(it, end);
-    eol_or_comment(it, end);
+    uint64_t bits = 0;
+    for (std::size_t i = 0; i < n; ++i)
+    {
+        if (structural_chars[static_cast<unsigned char>(p[i])])
+            bits |= UINT64_C(1) << i;
+    }
+    return bits;
 }
 
-void parser::parse_table_array(std::string::iterator& it,
-                       const std::string::iterator& end, table*& curr_table)
+inline int count_trailing_zeros(uint64_t bits)
 {
-    ++it;
-    if (it == end || *it == ']')
-        throw_parse_exception("Table array name cannot be empty");
+#if defined __GNUC__
+    return __builtin_ctzll(bits);
+#else
+    int n = 0;
+    while (!(bits & 1))
+    {
+        bits >>= 1;
+        ++n;
+    }
+    return n;
+#endif
+}
 
-    auto key_end = [](char c) { return c == ']'; };
+/**
+ * Where the statements, lines and arrays of a document are, as found by
+ * the first stage of the indexed engine.
+ */
+struct structural_index
+{
+    /**
+     * The offset of every newline in the document.
+     */
+    std::vector<std::size_t> newlines;
+
+    /**
+     * The number of lines the line engine would see, including the empty
+     * one it reads at the end of the input.
+     */
+    std::size_t line_count = 0;
+
+    /**
+     * The zero-based numbers of the first and last line of every
+     * statement.
+     */
+    std::vector<std::pair<std::size_t, std::size_t>> statements;
+
+    /**
+     * An upper bound on the number of elements of every array, in the order
+     * the arrays are opened in.
+     */
+    std::vector<std::size_t> array_sizes;
+};
 
-    std::string full_ta_name;
-    auto key_part_handler = [&](const std::string& part) {
-        if (part.empty())
-            throw_parse_exception("Empty component of table array name");
+/**
+ * The first stage of the indexed engine. Only the structural characters
+ * are visited, which are found 64 bytes at a time; that is enough to
+ * follow strings, comments and bracket nesting and so to tell which lines
+ * start a statement. Keys are the exception: they are lexed as leniently
+ * as parse_simple_key() does, where brackets and quotes can be part of a
+ * bare key, so they are stepped over one character at a time. Malformed
+ * input is left for the second stage to diagnose.
+ */
+inline void build_structural_index(const std::string& document,
+                                   structural_index& index)
+{
+    enum class state
+    {
+        NORMAL,
+        COMMENT,
+        BASIC_STRING,
+        LITERAL_STRING,
+        MULTILINE_BASIC_STRING,
+        MULTILINE_LITERAL_STRING
+    };
+
+    enum class bracket
+    {
+        HEADER,
+        ARRAY,
+        INLINE_TABLE
+    };
 
-        if (!full_ta_name.empty())
-            full_ta_name += '.';
-        full_ta_name += part;
+    // the vectors keep their storage from the last document
+    index.newlines.clear();
+    index.line_count = 0;
+    index.statements.clear();
+    index.array_sizes.clear();
+    const char* data = document.data();
+    std::size_t len = document.size();
 
-        if (curr_table->contains(part))
-        {
-#if !defined(__PGI)
-            auto b = curr_table->get(part);
-#else
-            // Workaround for PGI compiler
-            std::shared_ptr<base> b = curr_table->get(part);
-#endif
+    state st = state::NORMAL;
+    std::vector<std::pair<bracket, std::size_t>> open;
+    std::size_t resume = 0;
 
-            // if this is the end of the table array name, add an
-            // element to the table array that we just looked up,
-            // provided it was not declared inline
-            if (it != end && *it == ']')
-            {
-                if (!b->is_table_array())
-                {
-                    throw_parse_exception("Key " + full_ta_name
-                                          + " is not a table array");
-                }
+    auto at = [&](std::size_t i) { return i < len ? data[i] : '\0'; };
 
-                auto v = b->as_table_array();
+    auto skip_whitespace = [&](std::size_t pos) {
+        while (pos < len && (data[pos] == ' ' || data[pos] == '\t'))
+            ++pos;
+        return pos;
+    };
 
-                if (v->is_inline())
+    // returns where the dotted key starting at pos ends
+    auto skip_key = [&](std::size_t pos) {
+        while (true)
+        {
+            pos = skip_whitespace(pos);
+            char c = at(pos);
+            if (c == '"' || c == '\'')
+            {
+                for (++pos; pos < len && data[pos] != c && data[pos] != '\n';
+                     ++pos)
                 {
-                    throw_parse_exception("Static array " + full_ta_name
-                                          + " cannot be appended to");
+                    if (c == '"' && data[pos] == '\\' && at(pos + 1) != '\n')
+                        ++pos;
                 }
-
-                v->get().push_back(make_table());
-                curr_table = v->get().back().get();
+                if (at(pos) == c)
+                    ++pos;
+                pos = skip_whitespace(pos);
             }
-            // otherwise, just keep traversing down the key name
             else
             {
-                if (b->is_table())
-                    curr_table = static_cast<table*>(b.get());
-                else if (b->is_table_array())
-                    curr_table = std::static_pointer_cast<table_array>(b)
-                                     ->get()
-                                     .back()
-                                     .get();
-                else
-                    throw_parse_exception("Key " + full_ta_name
-                                          + " already exists as a value");
+                while (pos < len && data[pos] != '.' && data[pos] != '='
+                       && data[pos] != ']' && data[pos] != '\n')
+                    ++pos;
             }
+
+            if (at(pos) != '.')
+                return pos;
+            ++pos;
         }
-        else
+    };
+
+    // records a statement if the line starting at pos has one
+    auto start_line = [&](std::size_t pos) {
+        pos = skip_whitespace(pos);
+        char c = at(pos);
+        if (pos == len || c == '\n' || c == '#'
+            || (c == '\r' && at(pos + 1) == '\n'))
+            return;
+
+        index.statements.emplace_back(index.newlines.size(),
+                                      std::string::npos);
+        if (c == '[')
         {
-            // if this is the end of the table array name, add a new
-            // table array and a new table inside that array for us to
-            // add keys to next
-            if (it != end && *it == ']')
-            {
-                curr_table->insert(part, make_table_array());
-                auto arr = std::static_pointer_cast<table_array>(
-                    curr_table->get(part));
-                arr->get().push_back(make_table());
-                curr_table = arr->get().back().get();
-            }
-            // otherwise, create the implicitly defined table and move
-            // down to it
-            else
-            {
-                curr_table->insert(part, make_table());
-                curr_table
-                    = static_cast<table*>(curr_table->get(part).get());
-            }
+            // [table] or [[table array]]
+            open.emplace_back(bracket::HEADER, 0);
+            if (at(++pos) == '[')
+                open.emplace_back(bracket::HEADER, 0), ++pos;
         }
+        resume = skip_key(pos);
     };
 
-    key_part_handler(parse_key(it, end, key_end, key_part_handler));
-
-    // consume the last "]]"
-    auto eat = detail::make_consumer(it, end, [this]() {
-        throw_parse_exception("Unterminated table array name");
-    });
-    eat(']');
-    eat(']');
+    // an inline table starts with a key unless it is empty
+    auto inline_key = [&](std::size_t pos) {
+        pos = skip_whitespace(pos);
+        if (at(pos) != '}')
+            resume = skip_key(pos);
+    };
 
-    consume_whitespace(it, end);
-    eol_or_comment(it, end);
-}
+    start_line(0);
+    for (std::size_t block = 0; block < len; block += 64)
+    {
+        auto bits = structural_bits(data + block, std::min<std::size_t>(
+                                                      64, len - block));
+        while (bits)
+        {
+            auto pos = block + static_cast<std::size_t>(
+                                   count_trailing_zeros(bits));
+            bits &= bits - 1;
 
-void parser::parse_key_value(std::string::iterator& it, std::string::iterator& end,
-                     table* curr_table)
-{
-    auto key_end = [](char c) { return c == '='; };
+            // already stepped over as part of a key, an escape or a
+            // triple quote
+            if (pos < resume)
+                continue;
 
-    auto key_part_handler = [&](const std::string& part) {
-        // two cases: this key part exists already, in which case it must
-        // be a table, or it doesn't exist in which case we must create
-        // an implicitly defined table
-        if (curr_table->contains(part))
-        {
-            auto val = curr_table->get(part);
-            if (val->is_table())
+            char c = data[pos];
+            if (c == '\n')
             {
-                curr_table = static_cast<table*>(val.get());
+                index.newlines.push_back(pos);
+                if (st == state::COMMENT || st == state::BASIC_STRING
+                    || st == state::LITERAL_STRING)
+                    st = state::NORMAL;
+                if (st == state::NORMAL && open.empty())
+                {
+                    if (!index.statements.empty()
+                        && index.statements.back().second == std::string::npos)
+                        index.statements.back().second
+                            = index.newlines.size() - 1;
+                    start_line(pos + 1);
+                }
+                continue;
             }
-            else
+
+            switch (st)
             {
-                throw_parse_exception("Key " + part
-                                      + " already exists as a value");
+                case state::NORMAL:
+                    if (!open.empty() && open.back().first == bracket::HEADER)
+                    {
+                        if (c == ']')
+                            open.pop_back();
+                    }
+                    else if (c == '#')
+                    {
+                        st = state::COMMENT;
+                    }
+                    else if (c == '"' || c == '\'')
+                    {
+                        bool basic = c == '"';
+                        if (at(pos + 1) == c && at(pos + 2) == c)
+                        {
+                            st = basic ? state::MULTILINE_BASIC_STRING
+                                       : state::MULTILINE_LITERAL_STRING;
+                            resume = pos + 3;
+                        }
+                        else
+                        {
+                            st = basic ? state::BASIC_STRING
+                                       : state::LITERAL_STRING;
+                        }
+                    }
+                    else if (c == '[')
+                    {
+                        open.emplace_back(bracket::ARRAY,
+                                          index.array_sizes.size());
+                        index.array_sizes.push_back(1);
+                    }
+                    else if (c == '{')
+                    {
+                        open.emplace_back(bracket::INLINE_TABLE, 0);
+                        inline_key(pos + 1);
+                    }
+                    else if (c == ']' || c == '}')
+                    {
+                        if (!open.empty())
+                            open.pop_back();
+                    }
+                    else if (c == ',' && !open.empty())
+                    {
+                        if (open.back().first == bracket::ARRAY)
+                            ++index.array_sizes[open.back().second];
+                        else
+                            inline_key(pos + 1);
+                    }
+                    break;
+
+                case state::COMMENT:
+                    break;
+
+                case state::BASIC_STRING:
+                case state::MULTILINE_BASIC_STRING:
+                    if (c == '\\')
+                    {
+                        // a backslash ending the line doesn't hide the
+                        // newline
+                        if (at(pos + 1) != '\n')
+                            resume = pos + 2;
+                        break;
+                    }
+                    // fall through
+                case state::LITERAL_STRING:
+                case state::MULTILINE_LITERAL_STRING:
+                {
+                    char delim = st == state::BASIC_STRING
+                                         || st == state::MULTILINE_BASIC_STRING
+                                     ? '"'
+                                     : '\'';
+                    if (c != delim)
+                        break;
+                    if (st == state::BASIC_STRING
+                        || st == state::LITERAL_STRING)
+                    {
+                        st = state::NORMAL;
+                    }
+                    else if (at(pos + 1) == delim && at(pos + 2) == delim)
+                    {
+                        st = state::NORMAL;
+                        resume = pos + 3;
+                    }
+                    break;
+                }
             }
         }
-        else
-        {
-            auto newtable = make_table();
-            curr_table->insert(part, newtable);
-            curr_table = newtable.get();
-        }
-    };
+    }
 
-    auto key = parse_key(it, end, key_end, key_part_handler);
+    index.line_count = index.newlines.size() + 1;
+    if (len > 0 && data[len - 1] != '\n')
+        ++index.line_count;
 
-    if (curr_table->contains(key))
-        throw_parse_exception("Key " + key + " already present");
-    if (it == end || *it != '=')
-        throw_parse_exception("Value must follow after a '='");
-    ++it;
-    consume_whitespace(it, end);
-    curr_table->insert(key, parse_value(it, end));
-    consume_whitespace(it, end);
+    // the last line may end the last statement without a newline; one that
+    // is left open runs into the empty line at the end
+    if (!index.statements.empty()
+        && index.statements.back().second == std::string::npos)
+    {
+        bool closed = open.empty()
+                      && (st == state::NORMAL || st == state::COMMENT
+                          || st == state::BASIC_STRING
+                          || st == state::LITERAL_STRING);
+        index.statements.back().second
+            = closed ? index.newlines.size() : index.line_count - 1;
+    }
 }
 
-template <class KeyEndFinder, class KeyPartHandler>
-inline std::string
-parser::parse_key(std::string::iterator& it, const std::string::iterator& end,
-          KeyEndFinder&& key_end, KeyPartHandler&& key_part_handler)
+inline structural_index build_structural_index(const std::string& document)
 {
-    // parse the key as a series of one or more simple-keys joined with '.'
-    while (it != end && !key_end(*it))
-    {
-        auto part = parse_simple_key(it, end);
-        consume_whitespace(it, end);
+    structural_index index;
+    build_structural_index(document, index);
+    return index;
+}
 
-        if (it == end || key_end(*it))
-        {
-            return part;
-        }
+/**
+ * A document kept around by tables that are parsed lazily.
+ */
+struct lazy_document
+{
+    std::string text;
+    structural_index index;
+    bool defer_numbers;
+    bool keep_text;
+};
 
-        if (*it != '.')
-        {
-            std::string errmsg{"Unexpected character in key: "};
-            errmsg += '"';
-            errmsg += *it;
-            errmsg += '"';
-            throw_parse_exception(errmsg);
-        }
+/**
+ * The statements of a lazily parsed table that are still to be parsed.
+ */
+struct lazy_section
+{
+    lazy_section(std::shared_ptr<lazy_document> doc, std::size_t f,
+                 std::size_t l)
+        : document(std::move(doc)), first(f), last(l)
+    {
+        // nothing
+    }
 
-        key_part_handler(part);
+    std::shared_ptr<lazy_document> document;
+    std::size_t first;
+    std::size_t last;
 
-        // consume the dot
-        ++it;
-    }
+    // the first thread to look at the table parses it while holding the
+    // mutex; the builder looks at the table too, on the same thread
+    std::recursive_mutex mutex;
+    std::atomic<bool> loaded{false};
+    bool loading = false;
+    std::exception_ptr error;
+};
 
-    throw_parse_exception("Unexpected end of key");
+inline void read_document(std::istream& input, std::string& document)
+{
+    std::size_t size = 0;
+    do
+    {
+        document.resize(size + 65536);
+        input.read(&document[size], 65536);
+        size += static_cast<std::size_t>(input.gcount());
+    } while (input);
+    document.resize(size);
 }
+} // namespace detail
 
-std::string parser::parse_simple_key(std::string::iterator& it,
-                             const std::string::iterator& end)
+bool sax_parser::next_line()
 {
-    consume_whitespace(it, end);
+    if (index_)
+    {
+        // lines past the last newline are empty, like the one
+        // detail::getline yields at the end of the input
+        if (next_line_ >= index_->line_count)
+            return false;
+
+        const auto& newlines = index_->newlines;
+        auto begin = document_->size();
+        auto end = document_->size();
+        if (next_line_ <= newlines.size())
+            begin = next_line_ == 0 ? 0 : newlines[next_line_ - 1] + 1;
+        if (next_line_ < newlines.size())
+        {
+            end = newlines[next_line_];
+            if (end != begin && (*document_)[end - 1] == '\r')
+                --end;
+        }
 
-    if (it == end)
-        throw_parse_exception("Unexpected end of key (blank key?)");
+        line_begin_ = document_->begin() + static_cast<std::ptrdiff_t>(begin);
+        line_end_ = document_->begin() + static_cast<std::ptrdiff_t>(end);
+        ++next_line_;
+        return true;
+    }
 
-    if (*it == '"' || *it == '\'')
+    if (input_)
     {
-        return string_literal(it, end, *it);
+        if (!detail::getline(*input_, line_))
+            return false;
+    }
+    else if (buffer_ == buffer_end_)
+    {
+        // detail::getline yields one last empty line at the end of the
+        // input; do the same so line numbers agree between the two
+        if (!buffer_is_final_ || buffer_ == nullptr)
+            return false;
+        line_.clear();
+        buffer_ = nullptr;
+        buffer_end_ = nullptr;
     }
     else
     {
-        auto bke = std::find_if(it, end, [](char c) {
-            return c == '.' || c == '=' || c == ']';
-        });
-        return parse_bare_key(it, bke);
+        // same line ending rules as detail::getline: "\n" and "\r\n" end
+        // a line, a lone '\r' is part of it
+        auto len = static_cast<std::size_t>(buffer_end_ - buffer_);
+        auto nl = static_cast<const char*>(std::memchr(buffer_, '\n', len));
+        if (!nl)
+        {
+            line_.assign(buffer_, buffer_end_);
+            buffer_ = buffer_end_;
+        }
+        else
+        {
+            auto line_end = nl;
+            if (line_end != buffer_ && line_end[-1] == '\r')
+                --line_end;
+            line_.assign(buffer_, line_end);
+            buffer_ = nl + 1;
+        }
     }
+
+    line_begin_ = line_.begin();
+    line_end_ = line_.end();
+    return true;
 }
 
-std::string parser::parse_bare_key(std::string::iterator& it,
-                           const std::string::iterator& end)
+void sax_parser::parse()
 {
-    if (it == end)
+    if (index_)
     {
-        throw_parse_exception("Bare key missing name");
+        parse_indexed();
+        return;
     }
 
-    auto key_end = end;
-    --key_end;
-    consume_backwards_whitespace(key_end, it);
-    ++key_end;
-    std::string key{it, key_end};
+    while (next_line())
+    {
+        line_number_++;
+        parse_line();
+    }
+}
+
+void sax_parser::parse_line()
+{
+    auto it = line_begin_;
+    auto end = line_end_;
+    consume_whitespace(it, end);
+    if (it == end || *it == '#')
+        return;
+    if (*it == '[')
+    {
+        parse_table(it, end);
+    }
+    else
+    {
+        parse_key_value(it, end);
+        consume_whitespace(it, end);
+        eol_or_comment(it, end);
+    }
+}
+
+void sax_parser::parse_indexed()
+{
+    if (parse_statements(0, index_->statements.size()))
+        return;
+
+    // the index and the parser disagree about where a statement ends,
+    // which only happens on input the parser lexes leniently (e.g. a stray
+    // character closing an array); carry on with every line like the line
+    // engine does
+    while (next_line())
+    {
+        line_number_++;
+        parse_line();
+    }
+}
+
+bool sax_parser::parse_statements(std::size_t first, std::size_t last)
+{
+    for (auto i = first; i < last; ++i)
+    {
+        const auto& statement = index_->statements[i];
+        next_line_ = statement.first;
+        next_line();
+        line_number_ = statement.first + 1;
+        parse_line();
+
+        if (next_line_ != statement.second + 1)
+            return false;
+    }
+    return true;
+}
+
+void sax_parser::parse_table(std::string::iterator& it,
+                             const std::string::iterator& end)
+{
+    // remove the beginning keytable marker
+    ++it;
+    if (it == end)
+        throw_parse_exception("Unexpected end of table");
+    if (*it == '[')
+        parse_table_array(it, end);
+    else
+        parse_single_table(it, end);
+}
+
+void sax_parser::parse_single_table(std::string::iterator& it,
+                                    const std::string::iterator& end)
+{
+    if (it == end || *it == ']')
+        throw_parse_exception("Table name cannot be empty");
+
+    auto key_end = [](char c) { return c == ']'; };
+
+    parse_key(it, end, key_end);
+
+    for (const auto& part : key_)
+    {
+        if (part.empty())
+            throw_parse_exception("Empty component of table name");
+    }
+
+    if (it == end)
+        throw_parse_exception(
+            "Unterminated table declaration; did you forget a ']'?");
+
+    if (*it != ']')
+    {
+        std::string errmsg{"Unexpected character in table definition: "};
+        errmsg += '"';
+        errmsg += *it;
+        errmsg += '"';
+        throw_parse_exception(errmsg);
+    }
+
+    handler_.table_header(key_);
+
+    ++it;
+    consume_whitespace(it, end);
+    eol_or_comment(it, end);
+}
+
+void sax_parser::parse_table_array(std::string::iterator& it,
+                                   const std::string::iterator& end)
+{
+    ++it;
+    if (it == end || *it == ']')
+        throw_parse_exception("Table array name cannot be empty");
+
+    auto key_end = [](char c) { return c == ']'; };
+
+    parse_key(it, end, key_end);
+
+    for (const auto& part : key_)
+    {
+        if (part.empty())
+            throw_parse_exception("Empty component of table array name");
+    }
+
+    // consume the last "]]"
+    auto eat = detail::make_consumer(it, end, [this]() {
+        throw_parse_exception("Unterminated table array name");
+    });
+    eat(']');
+    eat(']');
+
+    handler_.table_array_header(key_);
+
+    consume_whitespace(it, end);
+    eol_or_comment(it, end);
+}
+
+void sax_parser::parse_key_value(std::string::iterator& it,
+                                 std::string::iterator& end)
+{
+    auto key_end = [](char c) { return c == '='; };
+
+    parse_key(it, end, key_end);
+
+    if (it == end || *it != '=')
+        throw_parse_exception("Value must follow after a '='");
+    ++it;
+    consume_whitespace(it, end);
+    handler_.key(key_);
+    parse_value(it, end);
+    consume_whitespace(it, end);
+}
+
+template <class KeyEndFinder>
+inline void sax_parser::parse_key(std::string::iterator& it,
+                                  const std::string::iterator& end,
+                                  KeyEndFinder&& key_end)
+{
+    key_.clear();
+
+    // parse the key as a series of one or more simple-keys joined with '.'
+    while (it != end && !key_end(*it))
+    {
+        key_.push_back(parse_simple_key(it, end));
+        consume_whitespace(it, end);
+
+        if (it == end || key_end(*it))
+        {
+            return;
+        }
+
+        if (*it != '.')
+        {
+            std::string errmsg{"Unexpected character in key: "};
+            errmsg += '"';
+            errmsg += *it;
+            errmsg += '"';
+            throw_parse_exception(errmsg);
+        }
+
+        // consume the dot
+        ++it;
+    }
+
+    throw_parse_exception("Unexpected end of key");
+}
+
+std::string sax_parser::parse_simple_key(std::string::iterator& it,
+                                         const std::string::iterator& end)
+{
+    consume_whitespace(it, end);
+
+    if (it == end)
+        throw_parse_exception("Unexpected end of key (blank key?)");
+
+    if (*it == '"' || *it == '\'')
+    {
+        std::string key;
+        string_literal(it, end, *it, key);
+        return key;
+    }
+    else
+    {
+        auto bke = std::find_if(it, end, [](char c) {
+            return c == '.' || c == '=' || c == ']';
+        });
+        return parse_bare_key(it, bke);
+    }
+}
+
+std::string sax_parser::parse_bare_key(std::string::iterator& it,
+                                       const std::string::iterator& end)
+{
+    if (it == end)
+    {
+        throw_parse_exception("Bare key missing name");
+    }
+
+    auto key_end = end;
+    --key_end;
+    consume_backwards_whitespace(key_end, it);
+    ++key_end;
+    std::string key{it, key_end};
 
     if (std::find(it, key_end, '#') != key_end)
     {
@@ -499,16 +1049,51 @@ enum class parse_type
     INLINE_TABLE
 };
 
-std::shared_ptr<base> parser::parse_value(std::string::iterator& it,
-                                  std::string::iterator& end)
+sax_parser::parse_type sax_parser::parse_value(std::string::iterator& it,
+                                               std::string::iterator& end)
 {
+    if (!keep_text_)
+        return parse_value_impl(it, end);
+
+    // multi-line strings can continue on lines that are read later, so
+    // their text is not kept
+    auto first = it;
+    bool multiline = end - it >= 3 && (*it == '"' || *it == '\'')
+                     && it[1] == *it && it[2] == *it;
+
+    auto type = parse_value_impl(it, end);
+    if (!multiline && type != parse_type::ARRAY
+        && type != parse_type::INLINE_TABLE)
+    {
+        // strings take the whitespace after them along
+        auto last = it;
+        while (last[-1] == ' ' || last[-1] == '\t')
+            --last;
+        handler_.value_text(std::string_view{
+            &*first, static_cast<std::size_t>(last - first)});
+    }
+    return type;
+}
+
+sax_parser::parse_type
+sax_parser::parse_value_impl(std::string::iterator& it,
+                             std::string::iterator& end)
+{
+    if (it != end && is_number(*it))
+    {
+        if (auto type = parse_datetime_fast(it, end))
+            return *type;
+    }
+
     parse_type type = determine_value_type(it, end);
     switch (type)
     {
         case parse_type::STRING:
-            return parse_string(it, end);
+            parse_string(it, end);
+            break;
         case parse_type::LOCAL_TIME:
-            return parse_time(it, end);
+            parse_time(it, end);
+            break;
         case parse_type::LOCAL_DATE:
         case parse_type::LOCAL_DATETIME:
         case parse_type::OFFSET_DATETIME:
@@ -517,18 +1102,23 @@ std::shared_ptr<base> parser::parse_value(std::string::iterator& it,
         case parse_type::FLOAT:
             return parse_number(it, end);
         case parse_type::BOOL:
-            return parse_bool(it, end);
+            parse_bool(it, end);
+            break;
         case parse_type::ARRAY:
-            return parse_array(it, end);
+            parse_array(it, end);
+            break;
         case parse_type::INLINE_TABLE:
-            return parse_inline_table(it, end);
+            parse_inline_table(it, end);
+            break;
         default:
             throw_parse_exception("Failed to parse value");
     }
+    return type;
 }
 
-parser::parse_type parser::determine_value_type(const std::string::iterator& it,
-                                const std::string::iterator& end)
+sax_parser::parse_type
+sax_parser::determine_value_type(const std::string::iterator& it,
+                                 const std::string::iterator& end)
 {
     if (it == end)
     {
@@ -569,8 +1159,9 @@ parser::parse_type parser::determine_value_type(const std::string::iterator& it,
     throw_parse_exception("Failed to parse value type");
 }
 
-parser::parse_type parser::determine_number_type(const std::string::iterator& it,
-                                 const std::string::iterator& end)
+sax_parser::parse_type
+sax_parser::determine_number_type(const std::string::iterator& it,
+                                  const std::string::iterator& end)
 {
     // determine if we are an integer or a float
     auto check_it = it;
@@ -598,8 +1189,8 @@ parser::parse_type parser::determine_number_type(const std::string::iterator& it
     }
 }
 
-std::shared_ptr<value<std::string>> parser::parse_string(std::string::iterator& it,
-                                                 std::string::iterator& end)
+void sax_parser::parse_string(std::string::iterator& it,
+                              std::string::iterator& end)
 {
     auto delim = *it;
     assert(delim == '"' || delim == '\'');
@@ -614,22 +1205,25 @@ std::shared_ptr<value<std::string>> parser::parse_string(std::string::iterator&
         if (check_it != end && *check_it == delim)
         {
             it = ++check_it;
-            return parse_multiline_string(it, end, delim);
+            value_.clear();
+            parse_multiline_string(it, end, delim, value_);
+            handler_.string_value(value_);
+            return;
         }
     }
-    return make_value<std::string>(string_literal(it, end, delim));
+    value_.clear();
+    string_literal(it, end, delim, value_);
+    handler_.string_value(value_);
 }
 
-std::shared_ptr<value<std::string>>
-parser::parse_multiline_string(std::string::iterator& it,
-                       std::string::iterator& end, char delim)
+void sax_parser::parse_multiline_string(std::string::iterator& it,
+                                        std::string::iterator& end,
+                                        char delim, std::string& str)
 {
-    std::stringstream ss;
-
     auto is_ws = [](char c) { return c == ' ' || c == '\t'; };
 
     bool consuming = false;
-    std::shared_ptr<value<std::string>> ret;
+    bool done = false;
 
     auto handle_line = [&](std::string::iterator& local_it,
                            std::string::iterator& local_end) {
@@ -646,8 +1240,19 @@ parser::parse_multiline_string(std::string::iterator& it,
 
         while (local_it != local_end)
         {
+            // copy everything up to the next character of interest in one
+            // go; only escapes and delimiters need a closer look
+            auto run = local_it;
+            while (local_it != local_end && *local_it != delim
+                   && !(delim == '"' && *local_it == '\\'))
+                ++local_it;
+            str.append(run, local_it);
+
+            if (local_it == local_end)
+                break;
+
             // handle escaped characters
-            if (delim == '"' && *local_it == '\\')
+            if (*local_it == '\\')
             {
                 auto check = local_it;
                 // check if this is an actual escape sequence or a
@@ -660,7 +1265,7 @@ parser::parse_multiline_string(std::string::iterator& it,
                     break;
                 }
 
-                ss << parse_escape_code(local_it, local_end);
+                parse_escape_code(local_it, local_end, str);
                 continue;
             }
 
@@ -673,118 +1278,111 @@ parser::parse_multiline_string(std::string::iterator& it,
                     && *check++ == delim)
                 {
                     local_it = check;
-                    ret = make_value<std::string>(ss.str());
+                    done = true;
                     break;
                 }
             }
 
-            ss << *local_it++;
+            str += *local_it++;
         }
     };
 
     // handle the remainder of the current line
     handle_line(it, end);
-    if (ret)
-        return ret;
+    if (done)
+        return;
 
     // start eating lines
-    while (detail::getline(input_, line_))
+    while (next_line())
     {
         ++line_number_;
 
-        it = line_.begin();
-        end = line_.end();
+        it = line_begin_;
+        end = line_end_;
 
         handle_line(it, end);
 
-        if (ret)
-            return ret;
+        if (done)
+            return;
 
         if (!consuming)
-            ss << std::endl;
+            str += '\n';
     }
 
     throw_parse_exception("Unterminated multi-line basic string");
 }
 
-std::string parser::string_literal(std::string::iterator& it,
-                           const std::string::iterator& end, char delim)
+void sax_parser::string_literal(std::string::iterator& it,
+                                const std::string::iterator& end, char delim,
+                                std::string& val)
 {
     ++it;
-    std::string val;
     while (it != end)
     {
+        auto run = it;
+        while (it != end && *it != delim && !(delim == '"' && *it == '\\'))
+            ++it;
+        val.append(run, it);
+
+        if (it == end)
+            break;
+
         // handle escaped characters
-        if (delim == '"' && *it == '\\')
+        if (*it == '\\')
         {
-            val += parse_escape_code(it, end);
+            parse_escape_code(it, end, val);
         }
-        else if (*it == delim)
+        else
         {
             ++it;
             consume_whitespace(it, end);
-            return val;
-        }
-        else
-        {
-            val += *it++;
+            return;
         }
     }
     throw_parse_exception("Unterminated string literal");
 }
 
-std::string parser::parse_escape_code(std::string::iterator& it,
-                              const std::string::iterator& end)
+void sax_parser::parse_escape_code(std::string::iterator& it,
+                                   const std::string::iterator& end,
+                                   std::string& out)
 {
     ++it;
     if (it == end)
         throw_parse_exception("Invalid escape sequence");
-    char value;
-    if (*it == 'b')
-    {
-        value = '\b';
-    }
-    else if (*it == 't')
-    {
-        value = '\t';
-    }
-    else if (*it == 'n')
-    {
-        value = '\n';
-    }
-    else if (*it == 'f')
-    {
-        value = '\f';
-    }
-    else if (*it == 'r')
-    {
-        value = '\r';
-    }
-    else if (*it == '"')
-    {
-        value = '"';
-    }
-    else if (*it == '\\')
-    {
-        value = '\\';
-    }
-    else if (*it == 'u' || *it == 'U')
+
+    auto c = static_cast<unsigned char>(*it);
+    if (c == 'u' || c == 'U')
     {
-        return parse_unicode(it, end);
+        parse_unicode(it, end, out);
+        return;
     }
-    else
-    {
+
+    char value = detail::escape_table[c];
+    if (!value)
         throw_parse_exception("Invalid escape sequence");
-    }
+
+    out += value;
     ++it;
-    return std::string(1, value);
 }
 
-std::string parser::parse_unicode(std::string::iterator& it,
-                          const std::string::iterator& end)
+void sax_parser::parse_unicode(std::string::iterator& it,
+                               const std::string::iterator& end,
+                               std::string& out)
 {
-    bool large = *it++ == 'U';
-    auto codepoint = parse_hex(it, end, large ? 0x10000000 : 0x1000);
+    int digits = *it++ == 'U' ? 8 : 4;
+
+    uint32_t codepoint = 0;
+    for (int i = 0; i < digits; ++i, ++it)
+    {
+        if (it == end)
+            throw_parse_exception("Unexpected end of unicode sequence");
+
+        auto digit = detail::hex_table[static_cast<unsigned char>(*it)];
+        if (digit > 0xf)
+            throw_parse_exception("Invalid unicode escape sequence");
+
+        codepoint = (codepoint << 4) | digit;
+    }
 
     if ((codepoint > 0xd7ff && codepoint < 0xe000) || codepoint > 0x10ffff)
     {
@@ -792,13 +1390,15 @@ std::string parser::parse_unicode(std::string::iterator& it,
             "Unicode escape sequence is not a Unicode scalar value");
     }
 
-    std::string result;
+    char buf[4];
+    std::size_t len;
     // See Table 3-6 of the Unicode standard
     if (codepoint <= 0x7f)
     {
         // 1-byte codepoints: 00000000 0xxxxxxx
         // repr: 0xxxxxxx
-        result += static_cast<char>(codepoint & 0x7f);
+        buf[0] = static_cast<char>(codepoint & 0x7f);
+        len = 1;
     }
     else if (codepoint <= 0x7ff)
     {
@@ -808,12 +1408,13 @@ std::string parser::parse_unicode(std::string::iterator& it,
         // 0x1f = 00011111
         // 0xc0 = 11000000
         //
-        result += static_cast<char>(0xc0 | ((codepoint >> 6) & 0x1f));
+        buf[0] = static_cast<char>(0xc0 | ((codepoint >> 6) & 0x1f));
         //
         // 0x80 = 10000000
         // 0x3f = 00111111
         //
-        result += static_cast<char>(0x80 | (codepoint & 0x3f));
+        buf[1] = static_cast<char>(0x80 | (codepoint & 0x3f));
+        len = 2;
     }
     else if (codepoint <= 0xffff)
     {
@@ -823,9 +1424,10 @@ std::string parser::parse_unicode(std::string::iterator& it,
         // 0xe0 = 11100000
         // 0x0f = 00001111
         //
-        result += static_cast<char>(0xe0 | ((codepoint >> 12) & 0x0f));
-        result += static_cast<char>(0x80 | ((codepoint >> 6) & 0x1f));
-        result += static_cast<char>(0x80 | (codepoint & 0x3f));
+        buf[0] = static_cast<char>(0xe0 | ((codepoint >> 12) & 0x0f));
+        buf[1] = static_cast<char>(0x80 | ((codepoint >> 6) & 0x3f));
+        buf[2] = static_cast<char>(0x80 | (codepoint & 0x3f));
+        len = 3;
     }
     else
     {
@@ -835,43 +1437,18 @@ std::string parser::parse_unicode(std::string::iterator& it,
         // 0xf0 = 11110000
         // 0x07 = 00000111
         //
-        result += static_cast<char>(0xf0 | ((codepoint >> 18) & 0x07));
-        result += static_cast<char>(0x80 | ((codepoint >> 12) & 0x3f));
-        result += static_cast<char>(0x80 | ((codepoint >> 6) & 0x3f));
-        result += static_cast<char>(0x80 | (codepoint & 0x3f));
-    }
-    return result;
-}
-
-uint32_t parser::parse_hex(std::string::iterator& it,
-                   const std::string::iterator& end, uint32_t place)
-{
-    uint32_t value = 0;
-    while (place > 0)
-    {
-        if (it == end)
-            throw_parse_exception("Unexpected end of unicode sequence");
-
-        if (!is_hex(*it))
-            throw_parse_exception("Invalid unicode escape sequence");
-
-        value += place * hex_to_digit(*it++);
-        place /= 16;
+        buf[0] = static_cast<char>(0xf0 | ((codepoint >> 18) & 0x07));
+        buf[1] = static_cast<char>(0x80 | ((codepoint >> 12) & 0x3f));
+        buf[2] = static_cast<char>(0x80 | ((codepoint >> 6) & 0x3f));
+        buf[3] = static_cast<char>(0x80 | (codepoint & 0x3f));
+        len = 4;
     }
-    return value;
-}
-
-uint32_t parser::hex_to_digit(char c)
-{
-    if (is_number(c))
-        return static_cast<uint32_t>(c - '0');
-    return 10
-           + static_cast<uint32_t>(c
-                                   - ((c >= 'a' && c <= 'f') ? 'a' : 'A'));
+    out.append(buf, len);
 }
 
-std::shared_ptr<base> parser::parse_number(std::string::iterator& it,
-                                   const std::string::iterator& end)
+sax_parser::parse_type
+sax_parser::parse_number(std::string::iterator& it,
+                         const std::string::iterator& end)
 {
     auto check_it = it;
     auto check_end = find_end_of_number(it, end);
@@ -916,26 +1493,39 @@ std::shared_ptr<base> parser::parse_number(std::string::iterator& it,
         ++check_it;
         char base = *check_it;
         ++check_it;
+        auto start = check_it;
         if (base == 'x')
-        {
             eat_hex();
-            return parse_int(it, check_it, 16);
+        else
+            eat_numbers();
+
+        // at most 60 bits worth of digits can't overflow
+        auto digits = check_it - start;
+        if (defer_numbers_
+            && digits <= (base == 'x' ? 15 : base == 'o' ? 20 : 60))
+        {
+            defer_number(it, check_it, false);
+            return parse_type::INT;
+        }
+
+        if (base == 'x')
+        {
+            handler_.integer_value(parse_int(it, check_it, 16));
+            return parse_type::INT;
         }
         else if (base == 'o')
         {
-            auto start = check_it;
-            eat_numbers();
             auto val = parse_int(start, check_it, 8, "0");
             it = start;
-            return val;
+            handler_.integer_value(val);
+            return parse_type::INT;
         }
         else // if (base == 'b')
         {
-            auto start = check_it;
-            eat_numbers();
             auto val = parse_int(start, check_it, 2);
             it = start;
-            return val;
+            handler_.integer_value(val);
+            return parse_type::INT;
         }
     }
 
@@ -950,7 +1540,8 @@ std::shared_ptr<base> parser::parse_number(std::string::iterator& it,
             if (*it == '-')
                 val = -val;
             it = check_it + 3;
-            return make_value(val);
+            handler_.float_value(val);
+            return parse_type::FLOAT;
         }
         else if (check_it[0] == 'n' && check_it[1] == 'a'
                  && check_it[2] == 'n')
@@ -959,7 +1550,8 @@ std::shared_ptr<base> parser::parse_number(std::string::iterator& it,
             if (*it == '-')
                 val = -val;
             it = check_it + 3;
-            return make_value(val);
+            handler_.float_value(val);
+            return parse_type::FLOAT;
         }
     }
 
@@ -980,38 +1572,70 @@ std::shared_ptr<base> parser::parse_number(std::string::iterator& it,
             eat_numbers();
         };
 
+        auto exp_begin = check_it;
         if (is_exp)
             eat_exp();
         else
             eat_numbers();
 
+        if (!is_exp)
+            exp_begin = check_it;
         if (!is_exp && check_it != end
             && (*check_it == 'e' || *check_it == 'E'))
         {
             ++check_it;
+            exp_begin = check_it;
             eat_exp();
         }
 
-        return parse_float(it, check_it);
+        // with a short mantissa and at most two exponent digits the value
+        // can neither overflow nor underflow
+        if (defer_numbers_ && check_it - it <= 32
+            && std::count_if(exp_begin, check_it, is_number) <= 2)
+        {
+            defer_number(it, check_it, true);
+            return parse_type::FLOAT;
+        }
+
+        handler_.float_value(parse_float(it, check_it));
+        return parse_type::FLOAT;
     }
     else
     {
-        return parse_int(it, check_it);
+        // at most 18 digits can't overflow
+        if (defer_numbers_ && check_it - it <= 18)
+        {
+            defer_number(it, check_it, false);
+            return parse_type::INT;
+        }
+
+        handler_.integer_value(parse_int(it, check_it));
+        return parse_type::INT;
     }
 }
 
-std::shared_ptr<value<int64_t>> parser::parse_int(std::string::iterator& it,
-                                          const std::string::iterator& end,
-                                          int base,
-                                          const char* prefix)
+void sax_parser::defer_number(std::string::iterator& it,
+                              const std::string::iterator& end, bool is_float)
 {
-    std::string v{it, end};
-    v = prefix + v;
-    v.erase(std::remove(v.begin(), v.end(), '_'), v.end());
+    value_.assign(it, end);
+    it = end;
+    if (is_float)
+        handler_.float_lexeme(value_);
+    else
+        handler_.integer_lexeme(value_);
+}
+
+int64_t sax_parser::parse_int(std::string::iterator& it,
+                              const std::string::iterator& end, int base,
+                              const char* prefix)
+{
+    std::string v{it, end};
+    v = prefix + v;
+    v.erase(std::remove(v.begin(), v.end(), '_'), v.end());
     it = end;
     try
     {
-        return make_value<int64_t>(std::stoll(v, nullptr, base));
+        return std::stoll(v, nullptr, base);
     }
     catch (const std::invalid_argument& ex)
     {
@@ -1025,8 +1649,8 @@ std::shared_ptr<value<int64_t>> parser::parse_int(std::string::iterator& it,
     }
 }
 
-std::shared_ptr<value<double>> parser::parse_float(std::string::iterator& it,
-                                           const std::string::iterator& end)
+double sax_parser::parse_float(std::string::iterator& it,
+                               const std::string::iterator& end)
 {
     std::string v{it, end};
     v.erase(std::remove(v.begin(), v.end(), '_'), v.end());
@@ -1035,7 +1659,7 @@ std::shared_ptr<value<double>> parser::parse_float(std::string::iterator& it,
     std::replace(v.begin(), v.end(), '.', decimal_point);
     try
     {
-        return make_value<double>(std::stod(v));
+        return std::stod(v);
     }
     catch (const std::invalid_argument& ex)
     {
@@ -1049,8 +1673,39 @@ std::shared_ptr<value<double>> parser::parse_float(std::string::iterator& it,
     }
 }
 
-std::shared_ptr<value<bool>> parser::parse_bool(std::string::iterator& it,
-                                        const std::string::iterator& end)
+namespace detail
+{
+void from_lexeme(const std::string& text, int64_t& out)
+{
+    int base = 10;
+    std::size_t pos = 0;
+    if (text.size() > 2 && text[0] == '0'
+        && (text[1] == 'x' || text[1] == 'o' || text[1] == 'b'))
+    {
+        base = text[1] == 'x' ? 16 : text[1] == 'o' ? 8 : 2;
+        pos = 2;
+    }
+
+    std::string v;
+    v.reserve(text.size());
+    std::remove_copy(text.begin() + static_cast<std::ptrdiff_t>(pos),
+                     text.end(), std::back_inserter(v), '_');
+    out = std::stoll(v, nullptr, base);
+}
+
+void from_lexeme(const std::string& text, double& out)
+{
+    std::string v;
+    v.reserve(text.size());
+    std::remove_copy(text.begin(), text.end(), std::back_inserter(v), '_');
+    char decimal_point = std::localeconv()->decimal_point[0];
+    std::replace(v.begin(), v.end(), '.', decimal_point);
+    out = std::stod(v);
+}
+} // namespace detail
+
+void sax_parser::parse_bool(std::string::iterator& it,
+                            const std::string::iterator& end)
 {
     auto eat = detail::make_consumer(it, end, [this]() {
         throw_parse_exception("Attempted to parse invalid boolean value");
@@ -1059,20 +1714,21 @@ std::shared_ptr<value<bool>> parser::parse_bool(std::string::iterator& it,
     if (*it == 't')
     {
         eat("true");
-        return make_value<bool>(true);
+        handler_.boolean_value(true);
+        return;
     }
     else if (*it == 'f')
     {
         eat("false");
-        return make_value<bool>(false);
+        handler_.boolean_value(false);
+        return;
     }
 
     eat.error();
-    return nullptr;
 }
 
-std::string::iterator parser::find_end_of_number(std::string::iterator it,
-                                         std::string::iterator end)
+std::string::iterator sax_parser::find_end_of_number(std::string::iterator it,
+                                                     std::string::iterator end)
 {
     auto ret = std::find_if(it, end, [](char c) {
         return !is_number(c) && c != '_' && c != '.' && c != 'e' && c != 'E'
@@ -1089,8 +1745,8 @@ std::string::iterator parser::find_end_of_number(std::string::iterator it,
     return ret;
 }
 
-std::string::iterator parser::find_end_of_date(std::string::iterator it,
-                                       std::string::iterator end)
+std::string::iterator sax_parser::find_end_of_date(std::string::iterator it,
+                                                   std::string::iterator end)
 {
     auto end_of_date = std::find_if(it, end, [](char c) {
         return !is_number(c) && c != '-';
@@ -1104,16 +1760,16 @@ std::string::iterator parser::find_end_of_date(std::string::iterator it,
     });
 }
 
-std::string::iterator parser::find_end_of_time(std::string::iterator it,
-                                       std::string::iterator end)
+std::string::iterator sax_parser::find_end_of_time(std::string::iterator it,
+                                                   std::string::iterator end)
 {
     return std::find_if(it, end, [](char c) {
         return !is_number(c) && c != ':' && c != '.';
     });
 }
 
-local_time parser::read_time(std::string::iterator& it,
-                     const std::string::iterator& end)
+local_time sax_parser::read_time(std::string::iterator& it,
+                                 const std::string::iterator& end)
 {
     auto time_end = find_end_of_time(it, end);
 
@@ -1145,14 +1801,15 @@ local_time parser::read_time(std::string::iterator& it,
     return ltime;
 }
 
-std::shared_ptr<value<local_time>>
-parser::parse_time(std::string::iterator& it, const std::string::iterator& end)
+void sax_parser::parse_time(std::string::iterator& it,
+                            const std::string::iterator& end)
 {
-    return make_value(read_time(it, end));
+    handler_.local_time_value(read_time(it, end));
 }
 
-std::shared_ptr<base> parser::parse_date(std::string::iterator& it,
-                                 const std::string::iterator& end)
+sax_parser::parse_type
+sax_parser::parse_date(std::string::iterator& it,
+                       const std::string::iterator& end)
 {
     auto date_end = find_end_of_date(it, end);
 
@@ -1167,7 +1824,10 @@ std::shared_ptr<base> parser::parse_date(std::string::iterator& it,
     ldate.day = eat.eat_digits(2);
 
     if (it == date_end)
-        return make_value(ldate);
+    {
+        handler_.local_date_value(ldate);
+        return parse_type::LOCAL_DATE;
+    }
 
     eat.eat_or('T', ' ');
 
@@ -1176,7 +1836,10 @@ std::shared_ptr<base> parser::parse_date(std::string::iterator& it,
     static_cast<local_time&>(ldt) = read_time(it, date_end);
 
     if (it == date_end)
-        return make_value(ldt);
+    {
+        handler_.local_datetime_value(ldt);
+        return parse_type::LOCAL_DATETIME;
+    }
 
     offset_datetime dt;
     static_cast<local_datetime&>(dt) = ldt;
@@ -1202,74 +1865,155 @@ std::shared_ptr<base> parser::parse_date(std::string::iterator& it,
     if (it != date_end)
         throw_parse_exception("Malformed date");
 
-    return make_value(dt);
+    handler_.offset_datetime_value(dt);
+    return parse_type::OFFSET_DATETIME;
+}
+
+option<sax_parser::parse_type>
+sax_parser::parse_datetime_fast(std::string::iterator& it,
+                                const std::string::iterator& end)
+{
+    // Only the canonical layouts are handled here; anything else (or
+    // anything followed by more date-like characters) is left to
+    // parse_time/parse_date so that their diagnostics are preserved.
+    const char* p = &*it;
+    const char* last = p + std::distance(it, end);
+    auto len = last - p;
+
+    if (len >= 8 && p[2] == ':')
+    {
+        local_time ltime;
+        auto time_end = detail::parse_time_fast(p, last, ltime);
+        if (!time_end || (time_end != last && detail::is_time_char(*time_end)))
+            return {};
+
+        it += time_end - p;
+        handler_.local_time_value(ltime);
+        return {parse_type::LOCAL_TIME};
+    }
+
+    if (len < 10 || p[4] != '-')
+        return {};
+
+    uint64_t ym;
+    uint64_t md;
+    if (!detail::match_layout(detail::load_le64(p),
+                              detail::year_month_digits,
+                              detail::year_month_separators, ym)
+        || !detail::match_layout(detail::load_le64(p + 2),
+                                 detail::month_day_digits,
+                                 detail::month_day_separators, md))
+    {
+        return {};
+    }
+
+    auto ym_pairs = detail::combine_digit_pairs(ym);
+    local_date ldate;
+    ldate.year = detail::pair_at(ym_pairs, 0) * 100
+                 + detail::pair_at(ym_pairs, 2);
+    ldate.month = detail::pair_at(ym_pairs, 5);
+    ldate.day = detail::pair_at(detail::combine_digit_pairs(md), 6);
+
+    if (len == 10
+        || (!detail::is_date_char(p[10])
+            && !(p[10] == ' ' && len > 11 && is_number(p[11]))))
+    {
+        it += 10;
+        handler_.local_date_value(ldate);
+        return {parse_type::LOCAL_DATE};
+    }
+
+    if (len < 19 || (p[10] != 'T' && p[10] != ' '))
+        return {};
+
+    local_datetime ldt;
+    static_cast<local_date&>(ldt) = ldate;
+    auto q = detail::parse_time_fast(p + 11, last, ldt);
+    if (!q)
+        return {};
+
+    if (q == last || !detail::is_date_char(*q))
+    {
+        it += q - p;
+        handler_.local_datetime_value(ldt);
+        return {parse_type::LOCAL_DATETIME};
+    }
+
+    offset_datetime dt;
+    static_cast<local_datetime&>(dt) = ldt;
+
+    if (*q == 'Z')
+    {
+        ++q;
+    }
+    else if ((*q == '+' || *q == '-') && last - q >= 6 && is_number(q[1])
+             && is_number(q[2]) && q[3] == ':' && is_number(q[4])
+             && is_number(q[5]))
+    {
+        int hoff = (q[1] - '0') * 10 + (q[2] - '0');
+        int moff = (q[4] - '0') * 10 + (q[5] - '0');
+        dt.hour_offset = (*q == '+') ? hoff : -hoff;
+        dt.minute_offset = (*q == '+') ? moff : -moff;
+        q += 6;
+    }
+    else
+    {
+        return {};
+    }
+
+    if (q != last && detail::is_date_char(*q))
+        return {};
+
+    it += q - p;
+    handler_.offset_datetime_value(dt);
+    return {parse_type::OFFSET_DATETIME};
 }
 
-std::shared_ptr<base> parser::parse_array(std::string::iterator& it,
-                                  std::string::iterator& end)
+void sax_parser::parse_array(std::string::iterator& it,
+                             std::string::iterator& end)
 {
     // this gets ugly because of the "homogeneity" restriction:
     // arrays can either be of only one type, or contain arrays
     // (each of those arrays could be of different types, though)
-    //
-    // because of the latter portion, we don't really have a choice
-    // but to represent them as arrays of base values...
     ++it;
 
     // ugh---have to read the first value to determine array type...
     skip_whitespace_and_comments(it, end);
 
+    handler_.begin_array();
+
     // edge case---empty array
     if (*it == ']')
     {
         ++it;
-        return make_array();
+        handler_.end_array();
+        return;
     }
 
-    auto val_end = std::find_if(
-        it, end, [](char c) { return c == ',' || c == ']' || c == '#'; });
-    parse_type type = determine_value_type(it, val_end);
-    switch (type)
-    {
-        case parse_type::STRING:
-            return parse_value_array<std::string>(it, end);
-        case parse_type::LOCAL_TIME:
-            return parse_value_array<local_time>(it, end);
-        case parse_type::LOCAL_DATE:
-            return parse_value_array<local_date>(it, end);
-        case parse_type::LOCAL_DATETIME:
-            return parse_value_array<local_datetime>(it, end);
-        case parse_type::OFFSET_DATETIME:
-            return parse_value_array<offset_datetime>(it, end);
-        case parse_type::INT:
-            return parse_value_array<int64_t>(it, end);
-        case parse_type::FLOAT:
-            return parse_value_array<double>(it, end);
-        case parse_type::BOOL:
-            return parse_value_array<bool>(it, end);
-        case parse_type::ARRAY:
-            return parse_object_array<array>(&parser::parse_array, '[', it,
-                                             end);
-        case parse_type::INLINE_TABLE:
-            return parse_object_array<table_array>(
-                &parser::parse_inline_table, '{', it, end);
-        default:
-            throw_parse_exception("Unable to parse array");
-    }
+    if (*it == '[')
+        parse_object_array(&sax_parser::parse_array, '[', it, end);
+    else if (*it == '{')
+        parse_object_array(&sax_parser::parse_inline_table, '{', it, end);
+    else
+        parse_value_array(it, end);
+
+    handler_.end_array();
 }
 
-template <class Value>
-inline std::shared_ptr<array>
-parser::parse_value_array(std::string::iterator& it,
-                          std::string::iterator& end)
+void sax_parser::parse_value_array(std::string::iterator& it,
+                                   std::string::iterator& end)
 {
-    auto arr = make_array();
+    // the first element decides the type of the array; integers are
+    // still accepted in an array of floats
+    option<parse_type> array_type;
     while (it != end && *it != ']')
     {
-        auto val = parse_value(it, end);
-        if (auto v = val->as<Value>())
-            arr->get().push_back(val);
-        else
+        auto type = parse_value(it, end);
+        if (!array_type)
+            array_type = type;
+        else if (type != *array_type
+                 && !(*array_type == parse_type::FLOAT
+                      && type == parse_type::INT))
             throw_parse_exception("Arrays must be homogeneous");
         skip_whitespace_and_comments(it, end);
         if (*it != ',')
@@ -1279,23 +2023,19 @@ parser::parse_value_array(std::string::iterator& it,
     }
     if (it != end)
         ++it;
-    return arr;
 }
 
-template <class Object, class Function>
-inline std::shared_ptr<Object>
-parser::parse_object_array(Function&& fun, char delim,
-                           std::string::iterator& it,
-                           std::string::iterator& end)
+template <class Function>
+inline void sax_parser::parse_object_array(Function&& fun, char delim,
+                                           std::string::iterator& it,
+                                           std::string::iterator& end)
 {
-    auto arr = detail::make_element<Object>();
-
     while (it != end && *it != ']')
     {
         if (*it != delim)
             throw_parse_exception("Unexpected character in array");
 
-        arr->get().push_back(((*this).*fun)(it, end));
+        ((*this).*fun)(it, end);
         skip_whitespace_and_comments(it, end);
 
         if (it == end || *it != ',')
@@ -1309,13 +2049,12 @@ parser::parse_object_array(Function&& fun, char delim,
         throw_parse_exception("Unterminated array");
 
     ++it;
-    return arr;
 }
 
-std::shared_ptr<table> parser::parse_inline_table(std::string::iterator& it,
-                                          std::string::iterator& end)
+void sax_parser::parse_inline_table(std::string::iterator& it,
+                                    std::string::iterator& end)
 {
-    auto tbl = make_table();
+    handler_.begin_inline_table();
     do
     {
         ++it;
@@ -1325,10 +2064,10 @@ std::shared_ptr<table> parser::parse_inline_table(std::string::iterator& it,
         consume_whitespace(it, end);
         if (it != end && *it != '}')
         {
-            parse_key_value(it, end, tbl.get());
+            parse_key_value(it, end);
             consume_whitespace(it, end);
         }
-    } while (*it == ',');
+    } while (it != end && *it == ',');
 
     if (it == end || *it != '}')
         throw_parse_exception("Unterminated inline table");
@@ -1336,40 +2075,157 @@ std::shared_ptr<table> parser::parse_inline_table(std::string::iterator& it,
     ++it;
     consume_whitespace(it, end);
 
-    return tbl;
+    handler_.end_inline_table();
 }
 
-void parser::skip_whitespace_and_comments(std::string::iterator& start,
-                                  std::string::iterator& end)
+void sax_parser::skip_whitespace_and_comments(std::string::iterator& start,
+                                              std::string::iterator& end)
 {
     consume_whitespace(start, end);
     while (start == end || *start == '#')
     {
-        if (!detail::getline(input_, line_))
+        if (!next_line())
             throw_parse_exception("Unclosed array");
         line_number_++;
-        start = line_.begin();
-        end = line_.end();
+        start = line_begin_;
+        end = line_end_;
         consume_whitespace(start, end);
     }
 }
 
-void parser::consume_whitespace(std::string::iterator& it,
-                        const std::string::iterator& end)
+void sax_parser::skip_value(std::string::iterator& it,
+                            std::string::iterator& end)
+{
+    if (it == end)
+        throw_parse_exception("Failed to parse value");
+
+    if (*it == '"' || *it == '\'')
+    {
+        skip_string(it, end);
+        return;
+    }
+
+    if (*it != '[' && *it != '{')
+    {
+        // a date and a time may be separated by a space
+        if (date_type(it, end))
+        {
+            it = find_end_of_date(it, end);
+            return;
+        }
+
+        // any other scalar runs up to the next delimiter
+        it = std::find_if(it, end, [](char c) {
+            return c == ' ' || c == '\t' || c == ',' || c == ']' || c == '}'
+                   || c == '#';
+        });
+        return;
+    }
+
+    int depth = 0;
+    while (true)
+    {
+        while (it != end)
+        {
+            char c = *it;
+            if (c == '"' || c == '\'')
+            {
+                skip_string(it, end);
+                continue;
+            }
+            if (c == '#')
+            {
+                it = end;
+                break;
+            }
+            ++it;
+            if (c == '[' || c == '{')
+            {
+                ++depth;
+            }
+            else if (c == ']' || c == '}')
+            {
+                if (--depth == 0)
+                    return;
+            }
+        }
+
+        if (!next_line())
+            throw_parse_exception("Unclosed array");
+        line_number_++;
+        it = line_begin_;
+        end = line_end_;
+    }
+}
+
+void sax_parser::skip_string(std::string::iterator& it,
+                             std::string::iterator& end)
+{
+    char delim = *it;
+    bool basic = delim == '"';
+
+    if (std::distance(it, end) >= 3 && it[1] == delim && it[2] == delim)
+    {
+        it += 3;
+        while (true)
+        {
+            while (it != end)
+            {
+                if (basic && *it == '\\')
+                {
+                    // an escape, or a backslash ending the line
+                    if (++it != end)
+                        ++it;
+                }
+                else if (*it == delim && std::distance(it, end) >= 3
+                         && it[1] == delim && it[2] == delim)
+                {
+                    it += 3;
+                    return;
+                }
+                else
+                {
+                    ++it;
+                }
+            }
+
+            if (!next_line())
+                throw_parse_exception("Unterminated multi-line basic string");
+            line_number_++;
+            it = line_begin_;
+            end = line_end_;
+        }
+    }
+
+    for (++it; it != end; ++it)
+    {
+        if (*it == delim)
+        {
+            ++it;
+            return;
+        }
+        if (basic && *it == '\\' && std::next(it) != end)
+            ++it;
+    }
+    throw_parse_exception("Unterminated string literal");
+}
+
+void sax_parser::consume_whitespace(std::string::iterator& it,
+                                    const std::string::iterator& end)
 {
     while (it != end && (*it == ' ' || *it == '\t'))
         ++it;
 }
 
-void parser::consume_backwards_whitespace(std::string::iterator& back,
-                                  const std::string::iterator& front)
+void sax_parser::consume_backwards_whitespace(
+    std::string::iterator& back, const std::string::iterator& front)
 {
     while (back != front && (*back == ' ' || *back == '\t'))
         --back;
 }
 
-void parser::eol_or_comment(const std::string::iterator& it,
-                    const std::string::iterator& end)
+void sax_parser::eol_or_comment(const std::string::iterator& it,
+                                const std::string::iterator& end)
 {
     if (it != end && *it != '#')
         throw_parse_exception("Unidentified trailing character '"
@@ -1377,8 +2233,8 @@ void parser::eol_or_comment(const std::string::iterator& it,
                               + "'---did you forget a '#'?");
 }
 
-bool parser::is_time(const std::string::iterator& it,
-             const std::string::iterator& end)
+bool sax_parser::is_time(const std::string::iterator& it,
+                         const std::string::iterator& end)
 {
     auto time_end = find_end_of_time(it, end);
     auto len = std::distance(it, time_end);
@@ -1395,8 +2251,9 @@ bool parser::is_time(const std::string::iterator& it,
     return true;
 }
 
-option<parser::parse_type> parser::date_type(const std::string::iterator& it,
-                             const std::string::iterator& end)
+option<sax_parser::parse_type>
+sax_parser::date_type(const std::string::iterator& it,
+                      const std::string::iterator& end)
 {
     auto date_end = find_end_of_date(it, end);
     auto len = std::distance(it, date_end);
@@ -1426,4 +2283,1458 @@ option<parser::parse_type> parser::date_type(const std::string::iterator& it,
     return {};
 }
 
+namespace detail
+{
+/**
+ * A sax_handler that builds the tree of tables for parser::parse().
+ */
+class dom_builder : public sax_handler
+{
+  public:
+    dom_builder() : root_(make_table()), curr_table_(root_.get())
+    {
+        // nothing
+    }
+
+    /**
+     * Builds the keys of a single table. Table headers can't be handled.
+     */
+    explicit dom_builder(table& section) : curr_table_(&section)
+    {
+        // nothing
+    }
+
+    /**
+     * Errors are reported at the line the given parser is on.
+     */
+    void set_location(const sax_parser& parser)
+    {
+        parser_ = &parser;
+    }
+
+    std::shared_ptr<table> root() const
+    {
+        return root_;
+    }
+
+    /**
+     * Hands over the tree built so far.
+     */
+    std::shared_ptr<table> take_root()
+    {
+        return std::move(root_);
+    }
+
+    /**
+     * Starts a new tree, keeping the storage of the bookkeeping.
+     */
+    void reset()
+    {
+        root_ = make_table();
+        curr_table_ = root_.get();
+        target_ = nullptr;
+        target_key_.clear();
+        frames_.clear();
+        array_sizes_ = nullptr;
+        next_array_ = 0;
+    }
+
+    /**
+     * The table the last header opened.
+     */
+    table* current_table() const
+    {
+        return curr_table_;
+    }
+
+    /**
+     * Gives the expected number of elements of every array, in the order
+     * they are opened in, so their storage can be reserved up front.
+     */
+    void set_array_sizes(const std::vector<std::size_t>& sizes)
+    {
+        array_sizes_ = &sizes;
+    }
+
+    /**
+     * Collects the next value into a slot of its own instead of a table,
+     * to be picked up by take_value().
+     */
+    void begin_value()
+    {
+        target_ = scratch_.get();
+        target_key_.clear();
+    }
+
+    /**
+     * Inserts an already built node where the last key() pointed.
+     */
+    void insert(const std::shared_ptr<base>& node)
+    {
+        add(node);
+    }
+
+    std::shared_ptr<base> take_value()
+    {
+        auto v = scratch_->get(std::string{});
+        scratch_->erase(std::string{});
+        return v;
+    }
+
+    void table_header(const std::vector<std::string>& path) override
+    {
+        curr_table_ = root_.get();
+
+        std::string full_table_name;
+        bool inserted = false;
+
+        for (const auto& part : path)
+        {
+            if (!full_table_name.empty())
+                full_table_name += '.';
+            full_table_name += part;
+
+            if (curr_table_->contains(part))
+            {
+                auto b = curr_table_->get(part);
+                if (b->is_table())
+                    curr_table_ = static_cast<table*>(b.get());
+                else if (b->is_table_array())
+                    curr_table_ = std::static_pointer_cast<table_array>(b)
+                                      ->get()
+                                      .back()
+                                      .get();
+                else
+                    throw_parse_exception("Key " + full_table_name
+                                          + "already exists as a value");
+            }
+            else
+            {
+                inserted = true;
+                curr_table_->insert(part, make_table());
+                curr_table_
+                    = static_cast<table*>(curr_table_->get(part).get());
+            }
+        }
+
+        // table already existed
+        if (!inserted)
+        {
+            auto is_value
+                = [](const std::pair<const std::string&,
+                                     const std::shared_ptr<base>&>& p) {
+                      return p.second->is_value();
+                  };
+
+            // if there are any values, we can't add values to this table
+            // since it has already been defined. If there aren't any
+            // values, then it was implicitly created by something like
+            // [a.b]
+            if (curr_table_->empty()
+                || std::any_of(curr_table_->begin(), curr_table_->end(),
+                               is_value))
+            {
+                throw_parse_exception("Redefinition of table "
+                                      + full_table_name);
+            }
+        }
+    }
+
+    void table_array_header(const std::vector<std::string>& path) override
+    {
+        curr_table_ = root_.get();
+
+        std::string full_ta_name;
+        for (std::size_t i = 0; i < path.size(); ++i)
+        {
+            const auto& part = path[i];
+            bool last = i + 1 == path.size();
+
+            if (!full_ta_name.empty())
+                full_ta_name += '.';
+            full_ta_name += part;
+
+            if (curr_table_->contains(part))
+            {
+                auto b = curr_table_->get(part);
+
+                // if this is the end of the table array name, add an
+                // element to the table array that we just looked up,
+                // provided it was not declared inline
+                if (last)
+                {
+                    if (!b->is_table_array())
+                    {
+                        throw_parse_exception("Key " + full_ta_name
+                                              + " is not a table array");
+                    }
+
+                    auto v = b->as_table_array();
+
+                    if (v->is_inline())
+                    {
+                        throw_parse_exception("Static array " + full_ta_name
+                                              + " cannot be appended to");
+                    }
+
+                    v->get().push_back(make_table());
+                    curr_table_ = v->get().back().get();
+                }
+                // otherwise, just keep traversing down the key name
+                else
+                {
+                    if (b->is_table())
+                        curr_table_ = static_cast<table*>(b.get());
+                    else if (b->is_table_array())
+                        curr_table_ = std::static_pointer_cast<table_array>(b)
+                                          ->get()
+                                          .back()
+                                          .get();
+                    else
+                        throw_parse_exception("Key " + full_ta_name
+                                              + " already exists as a value");
+                }
+            }
+            else
+            {
+                // if this is the end of the table array name, add a new
+                // table array and a new table inside that array for us to
+                // add keys to next
+                if (last)
+                {
+                    auto arr = make_table_array();
+                    arr->get().push_back(make_table());
+                    curr_table_->insert(part, arr);
+                    curr_table_ = arr->get().back().get();
+                }
+                // otherwise, create the implicitly defined table and move
+                // down to it
+                else
+                {
+                    curr_table_->insert(part, make_table());
+                    curr_table_
+                        = static_cast<table*>(curr_table_->get(part).get());
+                }
+            }
+        }
+    }
+
+    void key(const std::vector<std::string>& path) override
+    {
+        table* curr_table = frames_.empty() || frames_.back().is_array
+                                ? curr_table_
+                                : static_cast<table*>(
+                                      frames_.back().node.get());
+
+        // two cases for every part but the last: this key part exists
+        // already, in which case it must be a table, or it doesn't exist
+        // in which case we must create an implicitly defined table
+        for (std::size_t i = 0; i + 1 < path.size(); ++i)
+        {
+            const auto& part = path[i];
+            if (curr_table->contains(part))
+            {
+                auto val = curr_table->get(part);
+                if (val->is_table())
+                {
+                    curr_table = static_cast<table*>(val.get());
+                }
+                else
+                {
+                    throw_parse_exception("Key " + part
+                                          + " already exists as a value");
+                }
+            }
+            else
+            {
+                auto newtable = make_table();
+                curr_table->insert(part, newtable);
+                curr_table = newtable.get();
+            }
+        }
+
+        if (curr_table->contains(path.back()))
+            throw_parse_exception("Key " + path.back() + " already present");
+
+        target_ = curr_table;
+        target_key_ = path.back();
+    }
+
+    void string_value(const std::string& v) override
+    {
+        add_value(make_value(v));
+    }
+
+    void integer_value(int64_t v) override
+    {
+        add_value(make_value(v));
+    }
+
+    void float_value(double v) override
+    {
+        add_value(make_value(v));
+    }
+
+    void boolean_value(bool v) override
+    {
+        add_value(make_value(v));
+    }
+
+    void integer_lexeme(const std::string& text) override
+    {
+        auto v = make_value<int64_t>(0);
+        v->lexeme_.reset(new std::string{text});
+        v->deferred_ = true;
+        add_value(v);
+    }
+
+    void float_lexeme(const std::string& text) override
+    {
+        auto v = make_value<double>(0.0);
+        v->lexeme_.reset(new std::string{text});
+        v->deferred_ = true;
+        add_value(v);
+    }
+
+    void local_date_value(const local_date& v) override
+    {
+        add_value(make_value(v));
+    }
+
+    void local_time_value(const local_time& v) override
+    {
+        add_value(make_value(v));
+    }
+
+    void local_datetime_value(const local_datetime& v) override
+    {
+        add_value(make_value(v));
+    }
+
+    void offset_datetime_value(const offset_datetime& v) override
+    {
+        add_value(make_value(v));
+    }
+
+    void value_text(std::string_view text) override
+    {
+        keep_text_(*last_value_, text);
+    }
+
+    void begin_array() override
+    {
+        // the kind of array is only known once its first element shows
+        // up: arrays of inline tables become (inline) table arrays
+        std::size_t size = 0;
+        if (array_sizes_ && next_array_ < array_sizes_->size())
+            size = (*array_sizes_)[next_array_++];
+        frames_.push_back(
+            {true, nullptr, target_, std::move(target_key_), size});
+    }
+
+    void end_array() override
+    {
+        if (!frames_.back().node)
+            frames_.back().node = make_array();
+        close_frame();
+    }
+
+    void begin_inline_table() override
+    {
+        frames_.push_back(
+            {false, make_table(), target_, std::move(target_key_), 0});
+    }
+
+    void end_inline_table() override
+    {
+        close_frame();
+    }
+
+  private:
+#if defined _MSC_VER
+    __declspec(noreturn)
+#elif defined __GNUC__
+    __attribute__((noreturn))
+#endif
+    void throw_parse_exception(const std::string& err)
+    {
+        throw parse_exception{err, parser_ ? parser_->line_number() : 0};
+    }
+
+    /**
+     * An array or inline table that is still being filled in, along with
+     * the place its parent wants it to go.
+     */
+    struct frame
+    {
+        bool is_array;
+        std::shared_ptr<base> node;
+        table* target;
+        std::string target_key;
+        std::size_t expected_size;
+    };
+
+    /**
+     * Adds a scalar, remembering it for the value_text() that may follow.
+     */
+    template <class T>
+    void add_value(const std::shared_ptr<value<T>>& v)
+    {
+        last_value_ = v.get();
+        keep_text_ = &keep_text<T>;
+        add(v);
+    }
+
+    template <class T>
+    static void keep_text(base& b, std::string_view text)
+    {
+        // deferred numbers already hold the same text
+        auto& v = static_cast<value<T>&>(b);
+        if (!v.lexeme_)
+            v.lexeme_.reset(new std::string{text});
+        v.verbatim_ = true;
+    }
+
+    void add(const std::shared_ptr<base>& node)
+    {
+        if (frames_.empty() || !frames_.back().is_array)
+        {
+            target_->insert(target_key_, node);
+            return;
+        }
+
+        auto& arr = frames_.back().node;
+        if (!arr)
+        {
+            auto size = frames_.back().expected_size;
+            if (node->is_table())
+            {
+                auto tarr = make_table_array(true);
+                tarr->reserve(size);
+                arr = tarr;
+            }
+            else
+            {
+                auto varr = make_array();
+                varr->reserve(size);
+                arr = varr;
+            }
+        }
+
+        if (arr->is_table_array())
+            static_cast<table_array&>(*arr).get().push_back(
+                std::static_pointer_cast<table>(node));
+        else
+            static_cast<array&>(*arr).get().push_back(node);
+    }
+
+    void close_frame()
+    {
+        auto node = std::move(frames_.back().node);
+        target_ = frames_.back().target;
+        target_key_ = std::move(frames_.back().target_key);
+        frames_.pop_back();
+        add(node);
+    }
+
+    const sax_parser* parser_ = nullptr;
+    std::shared_ptr<table> root_;
+    table* curr_table_;
+    table* target_ = nullptr;
+    std::string target_key_;
+    std::vector<frame> frames_;
+    const std::vector<std::size_t>* array_sizes_ = nullptr;
+    std::size_t next_array_ = 0;
+    std::shared_ptr<table> scratch_ = make_table();
+
+    // the last scalar added, and how to keep its text
+    base* last_value_ = nullptr;
+    void (*keep_text_)(base&, std::string_view) = nullptr;
+};
+} // namespace detail
+
+namespace detail
+{
+/**
+ * A stream buffer that reads another one on a separate thread. There are
+ * two blocks: while the parser works through one of them, the other is
+ * being filled.
+ */
+class pipelined_streambuf : public std::streambuf
+{
+  public:
+    static constexpr std::size_t block_size = 1 << 16;
+
+    explicit pipelined_streambuf(std::streambuf& source) : source_(source)
+    {
+        for (auto& block : blocks_)
+            block.data.resize(block_size);
+        reader_ = std::thread{[this]() { read(); }};
+    }
+
+    ~pipelined_streambuf() override
+    {
+        {
+            std::lock_guard<std::mutex> lock{mutex_};
+            stopping_ = true;
+        }
+        changed_.notify_all();
+        reader_.join();
+    }
+
+  protected:
+    int_type underflow() override
+    {
+        std::unique_lock<std::mutex> lock{mutex_};
+
+        // the block that was being read from can be filled again
+        if (gptr())
+        {
+            blocks_[current_].full = false;
+            current_ ^= 1;
+            changed_.notify_all();
+        }
+
+        auto& block = blocks_[current_];
+        waiting_ = true;
+        changed_.wait(lock, [&]() { return block.full || done_; });
+        waiting_ = false;
+        if (!block.full)
+        {
+            setg(nullptr, nullptr, nullptr);
+            if (error_)
+                std::rethrow_exception(error_);
+            return traits_type::eof();
+        }
+
+        auto data = &block.data[0];
+        setg(data, data, data + block.size);
+        return traits_type::to_int_type(*data);
+    }
+
+  private:
+    struct block
+    {
+        std::string data;
+        std::size_t size = 0;
+        bool full = false;
+    };
+
+    void read()
+    {
+        for (std::size_t next = 0;; next ^= 1)
+        {
+            auto& block = blocks_[next];
+            {
+                std::unique_lock<std::mutex> lock{mutex_};
+                changed_.wait(lock,
+                              [&]() { return stopping_ || !block.full; });
+                if (stopping_)
+                    return;
+            }
+
+            std::size_t size = 0;
+            bool ended = false;
+            std::exception_ptr error;
+            try
+            {
+                // the block is handed over when it is full, as soon as the
+                // parser has run out of input, or before waiting for the
+                // source while it holds something the parser hasn't seen
+                while (size < block_size && !(ended = fill(block, size)))
+                {
+                    {
+                        std::lock_guard<std::mutex> lock{mutex_};
+                        if (waiting_ || stopping_)
+                            break;
+                    }
+                    if (source_.in_avail() <= 0)
+                        break;
+                }
+            }
+            catch (...)
+            {
+                error = std::current_exception();
+            }
+
+            {
+                std::lock_guard<std::mutex> lock{mutex_};
+                block.size = size;
+                block.full = size > 0;
+                error_ = error;
+                done_ = ended || error;
+            }
+            changed_.notify_all();
+            if (ended || error)
+                return;
+        }
+    }
+
+    /**
+     * Waits for the source to have something and appends what has arrived
+     * to the block. Returns whether the source has ended.
+     */
+    bool fill(block& block, std::size_t& size)
+    {
+        auto data = &block.data[0] + size;
+        auto space = block_size - size;
+        if (traits_type::eq_int_type(source_.sgetc(), traits_type::eof()))
+            return true;
+
+        // a source that can't tell how much it has fills the whole block,
+        // and a short read means it has ended
+        auto available = source_.in_avail();
+        if (available <= 0)
+        {
+            auto n = static_cast<std::size_t>(
+                source_.sgetn(data, static_cast<std::streamsize>(space)));
+            size += n;
+            return n < space;
+        }
+
+        auto n = std::min(static_cast<std::size_t>(available), space);
+        size += static_cast<std::size_t>(
+            source_.sgetn(data, static_cast<std::streamsize>(n)));
+        return false;
+    }
+
+    std::streambuf& source_;
+    block blocks_[2];
+    std::size_t current_ = 0;
+    std::mutex mutex_;
+    std::condition_variable changed_;
+    bool done_ = false;
+    bool stopping_ = false;
+    bool waiting_ = false;
+    std::exception_ptr error_;
+    std::thread reader_;
+};
+
+/**
+ * What a parser keeps from one document to the next.
+ */
+struct parse_scratch
+{
+    parse_scratch() : sax{nullptr, 0, builder}
+    {
+        builder.set_location(sax);
+    }
+
+    dom_builder builder;
+    sax_parser sax;
+    std::string document;
+    structural_index index;
+};
+} // namespace detail
+
+parser::parser(std::istream& stream, const parse_options& options)
+    : input_(&stream), options_(options)
+{
+    // nothing
+}
+
+parser::parser(const char* data, std::size_t len, const parse_options& options)
+    : buffer_(data), buffer_end_(data + len), options_(options)
+{
+    // nothing
+}
+
+parser::~parser() = default;
+
+std::shared_ptr<table> parser::parse()
+{
+    if (options_.lazy)
+        return parse_lazily();
+
+    auto threads = options_.threads;
+    if (threads == 0)
+        threads = std::thread::hardware_concurrency();
+    if (threads > 1)
+        return parse_in_parallel(threads);
+
+    if (!scratch_)
+        scratch_.reset(new detail::parse_scratch);
+
+    auto& builder = scratch_->builder;
+    auto& sax = scratch_->sax;
+    builder.reset();
+    sax.reset(input_, buffer_, buffer_end_);
+    sax.defer_numbers_ = options_.defer_conversion;
+    sax.keep_text_ = options_.keep_source_text;
+
+    if (options_.engine == parse_engine::INDEXED)
+    {
+        read_document(scratch_->document);
+        detail::build_structural_index(scratch_->document, scratch_->index);
+        sax.input_ = nullptr;
+        sax.document_ = &scratch_->document;
+        sax.index_ = &scratch_->index;
+        builder.set_array_sizes(scratch_->index.array_sizes);
+    }
+    else if (options_.pipelined && input_)
+    {
+        detail::pipelined_streambuf buffer{*input_->rdbuf()};
+        std::istream stream{&buffer};
+        sax.input_ = &stream;
+        sax.parse();
+        input_->setstate(std::ios::eofbit);
+        return builder.take_root();
+    }
+
+    sax.parse();
+    return builder.take_root();
+}
+
+void parser::read_document(std::string& document)
+{
+    if (input_)
+        detail::read_document(*input_, document);
+    else
+        document.assign(buffer_, buffer_end_);
+}
+
+std::shared_ptr<table> parser::parse_lazily()
+{
+    auto document = std::make_shared<detail::lazy_document>();
+    read_document(document->text);
+    document->index = detail::build_structural_index(document->text);
+    document->defer_numbers = options_.defer_conversion;
+    document->keep_text = options_.keep_source_text;
+
+    std::vector<table*> sections;
+    return parse_headers(document, sections);
+}
+
+std::shared_ptr<table> parser::parse_in_parallel(unsigned threads)
+{
+    auto document = std::make_shared<detail::lazy_document>();
+    read_document(document->text);
+    document->index = detail::build_structural_index(document->text);
+    document->defer_numbers = options_.defer_conversion;
+    document->keep_text = options_.keep_source_text;
+
+    // on errors the document is parsed again the usual way, so the same
+    // error is reported as without threads, for the same line
+    auto parse_sequentially = [&]() {
+        auto options = options_;
+        options.threads = 1;
+        const auto& text = document->text;
+        return parser{text.data(), text.size(), options}.parse();
+    };
+
+    std::vector<table*> sections;
+    std::shared_ptr<table> root;
+    try
+    {
+        root = parse_headers(document, sections);
+    }
+    catch (const parse_exception&)
+    {
+        return parse_sequentially();
+    }
+
+    // a table that was still empty when its body was deferred only
+    // gets keys from that body, so it can be filled in on its own. The
+    // others already hold tables named by earlier headers, which their
+    // body may add to, so they are filled in afterwards, in order
+    std::vector<table*> independent;
+    std::vector<table*> dependent;
+    std::unordered_set<table*> seen;
+    for (auto section : sections)
+    {
+        if (!seen.insert(section).second)
+            continue;
+        if (section->map_.empty())
+            independent.push_back(section);
+        else
+            dependent.push_back(section);
+    }
+
+    std::atomic<std::size_t> next{0};
+    std::atomic<bool> failed{false};
+    auto work = [&]() {
+        std::size_t i;
+        while (!failed && (i = next++) < independent.size())
+        {
+            try
+            {
+                independent[i]->load();
+            }
+            catch (...)
+            {
+                failed = true;
+            }
+        }
+    };
+
+    auto count = static_cast<unsigned>(
+        std::min<std::size_t>(threads, independent.size()));
+
+    std::vector<std::thread> workers;
+    for (unsigned i = 1; i < count; ++i)
+        workers.emplace_back(work);
+    work();
+    for (auto& worker : workers)
+        worker.join();
+
+    try
+    {
+        if (!failed)
+        {
+            for (auto section : dependent)
+                section->load();
+        }
+    }
+    catch (const parse_exception&)
+    {
+        failed = true;
+    }
+
+    if (failed)
+        return parse_sequentially();
+    return root;
+}
+
+std::shared_ptr<table>
+parser::parse_headers(const std::shared_ptr<detail::lazy_document>& document,
+                      std::vector<table*>& sections)
+{
+    detail::dom_builder builder;
+    sax_parser sax{nullptr, 0, builder};
+    builder.set_location(sax);
+    sax.document_ = &document->text;
+    sax.index_ = &document->index;
+
+    // hands the statements between two headers to the table the first of
+    // them opened
+    auto defer = [&](table* section, std::size_t first, std::size_t last) {
+        if (first == last)
+            return;
+        section->load();
+        section->source_
+            = std::make_shared<detail::lazy_section>(document, first, last);
+        sections.push_back(section);
+    };
+
+    const auto& statements = document->index.statements;
+    const auto& newlines = document->index.newlines;
+    table* section = builder.root().get();
+    std::size_t body = 0;
+    for (std::size_t i = 0; i < statements.size(); ++i)
+    {
+        auto pos = statements[i].first == 0
+                       ? 0
+                       : newlines[statements[i].first - 1] + 1;
+        pos = document->text.find_first_not_of(" \t", pos);
+        if (document->text[pos] != '[')
+            continue;
+
+        defer(section, body, i);
+
+        // looking up the tables on the way to the one this header names
+        // loads them, so they are checked in document order
+        if (!sax.parse_statements(i, i + 1))
+            sax.throw_parse_exception("Unexpected end of table header");
+        section = builder.current_table();
+        body = i + 1;
+    }
+    defer(section, body, statements.size());
+
+    return builder.root();
+}
+
+void table::load_source() const
+{
+    auto& section = *source_;
+    if (section.loaded.load(std::memory_order_acquire))
+        return;
+
+    std::lock_guard<std::recursive_mutex> lock{section.mutex};
+    if (section.error)
+        std::rethrow_exception(section.error);
+    if (section.loaded.load(std::memory_order_relaxed) || section.loading)
+        return;
+    section.loading = true;
+
+    detail::dom_builder builder{*const_cast<table*>(this)};
+    sax_parser sax{nullptr, 0, builder};
+    builder.set_location(sax);
+    sax.document_ = &section.document->text;
+    sax.index_ = &section.document->index;
+    sax.defer_numbers_ = section.document->defer_numbers;
+    sax.keep_text_ = section.document->keep_text;
+
+    // a failed body may already have added to the tables below this one,
+    // so it is not parsed again: every later access reports the same error
+    try
+    {
+        if (!sax.parse_statements(section.first, section.last))
+            sax.throw_parse_exception(
+                "Could not find the end of this statement");
+    }
+    catch (...)
+    {
+        section.error = std::current_exception();
+        section.document.reset();
+        throw;
+    }
+
+    section.document.reset();
+    section.loaded.store(true, std::memory_order_release);
+}
+
+namespace detail
+{
+/**
+ * The set of key paths a projected parse is asked to build.
+ */
+class projection
+{
+  public:
+    projection(const std::vector<std::string>& keys)
+    {
+        for (const auto& key : keys)
+        {
+            std::vector<std::string> path;
+            std::string::size_type start = 0;
+            std::string::size_type dot;
+            while ((dot = key.find('.', start)) != std::string::npos)
+            {
+                path.push_back(key.substr(start, dot - start));
+                start = dot + 1;
+            }
+            path.push_back(key.substr(start));
+            paths_.push_back(std::move(path));
+        }
+    }
+
+    /**
+     * Whether everything at path is to be built.
+     */
+    bool selects(const std::vector<std::string>& path) const
+    {
+        return std::any_of(paths_.begin(), paths_.end(),
+                           [&](const std::vector<std::string>& p) {
+                               return is_prefix(p, path);
+                           });
+    }
+
+    /**
+     * Whether anything at or below path is to be built.
+     */
+    bool touches(const std::vector<std::string>& path) const
+    {
+        return std::any_of(paths_.begin(), paths_.end(),
+                           [&](const std::vector<std::string>& p) {
+                               return is_prefix(p, path)
+                                      || is_prefix(path, p);
+                           });
+    }
+
+    /**
+     * Removes everything that isn't selected from a table found at path.
+     */
+    void prune(table& t, std::vector<std::string>& path) const
+    {
+        for (auto it = t.begin(); it != t.end();)
+        {
+            path.push_back(it->first);
+            if (selects(path))
+            {
+                ++it;
+            }
+            else if (touches(path)
+                     && (it->second->is_table()
+                         || it->second->is_table_array()))
+            {
+                prune(*it->second, path);
+                ++it;
+            }
+            else
+            {
+                it = t.erase(it);
+            }
+            path.pop_back();
+        }
+    }
+
+    void prune(base& node, std::vector<std::string>& path) const
+    {
+        if (node.is_table())
+        {
+            prune(static_cast<table&>(node), path);
+        }
+        else if (node.is_table_array())
+        {
+            // array indices are not part of key paths
+            for (auto& elem : static_cast<table_array&>(node).get())
+                prune(*elem, path);
+        }
+    }
+
+  private:
+    static bool is_prefix(const std::vector<std::string>& prefix,
+                          const std::vector<std::string>& path)
+    {
+        return prefix.size() <= path.size()
+               && std::equal(prefix.begin(), prefix.end(), path.begin());
+    }
+
+    std::vector<std::vector<std::string>> paths_;
+};
+} // namespace detail
+
+std::shared_ptr<table> parser::parse(const std::vector<std::string>& keys)
+{
+    detail::projection projection{keys};
+    detail::dom_builder builder;
+    auto reader = input_ ? toml_reader{*input_}
+                         : toml_reader{buffer_,
+                                       static_cast<std::size_t>(buffer_end_
+                                                                - buffer_)};
+    builder.set_location(reader.parser_);
+    reader.parser_.defer_numbers_ = options_.defer_conversion;
+    reader.parser_.keep_text_ = options_.keep_source_text;
+
+    std::vector<std::string> path;
+    toml_reader::event e;
+    while ((e = reader.next()) != toml_reader::event::END)
+    {
+        if (e != toml_reader::event::KEY)
+        {
+            // skipping a table also skips the tables nested under it, none
+            // of which can be selected either
+            if (!projection.touches(reader.current_table()))
+                reader.skip();
+            else if (e == toml_reader::event::TABLE)
+                builder.table_header(reader.current_table());
+            else
+                builder.table_array_header(reader.current_table());
+            continue;
+        }
+
+        path = reader.current_table();
+        path.insert(path.end(), reader.current_key().begin(),
+                    reader.current_key().end());
+
+        if (!projection.touches(path))
+            continue;
+
+        auto v = reader.value();
+        if (!projection.selects(path))
+        {
+            // an inline table or table array on the way to a selected key
+            if (!v->is_table() && !v->is_table_array())
+                continue;
+            projection.prune(*v, path);
+        }
+
+        builder.key(reader.current_key());
+        builder.insert(v);
+    }
+
+    return builder.root();
+}
+
+push_parser::push_parser()
+    : builder_(new detail::dom_builder), parser_(nullptr, 0, *builder_)
+{
+    builder_->set_location(parser_);
+}
+
+push_parser::push_parser(sax_handler& handler) : parser_(nullptr, 0, handler)
+{
+    // nothing
+}
+
+push_parser::~push_parser() = default;
+
+void push_parser::feed(const char* data, std::size_t len)
+{
+    buffer_.append(data, len);
+    scan(false);
+    if (complete_ > 0)
+        parse_prefix(complete_, false);
+}
+
+std::shared_ptr<table> push_parser::finish()
+{
+    scan(true);
+    parse_prefix(buffer_.size(), true);
+    return builder_ ? builder_->root() : nullptr;
+}
+
+void push_parser::scan(bool at_eof)
+{
+    // Only as much of the grammar as is needed to tell whether a newline
+    // ends a statement: it doesn't if it is inside a multi-line string or
+    // inside brackets (multi-line arrays). Anything malformed is left for
+    // the parser to diagnose.
+    auto data = buffer_.data();
+    auto size = buffer_.size();
+    auto pos = scanned_;
+
+    // true if the character at offset i can't be inspected yet
+    auto pending = [&](std::size_t i) { return i >= size && !at_eof; };
+    auto at = [&](std::size_t i) { return i < size ? data[i] : '\0'; };
+
+    while (pos < size)
+    {
+        char c = data[pos];
+        switch (state_)
+        {
+            case scan_state::NORMAL:
+                if (c == '\n')
+                {
+                    if (depth_ <= 0)
+                    {
+                        depth_ = 0;
+                        complete_ = pos + 1;
+                    }
+                }
+                else if (c == '#')
+                {
+                    state_ = scan_state::COMMENT;
+                }
+                else if (c == '[' || c == '{')
+                {
+                    ++depth_;
+                }
+                else if (c == ']' || c == '}')
+                {
+                    --depth_;
+                }
+                else if (c == '"' || c == '\'')
+                {
+                    if (pending(pos + 2))
+                    {
+                        scanned_ = pos;
+                        return;
+                    }
+
+                    if (at(pos + 1) == c && at(pos + 2) == c)
+                    {
+                        state_ = c == '"'
+                                     ? scan_state::MULTILINE_BASIC_STRING
+                                     : scan_state::MULTILINE_LITERAL_STRING;
+                        pos += 2;
+                    }
+                    else if (at(pos + 1) == c)
+                    {
+                        // empty string
+                        ++pos;
+                    }
+                    else
+                    {
+                        state_ = c == '"' ? scan_state::BASIC_STRING
+                                          : scan_state::LITERAL_STRING;
+                    }
+                }
+                ++pos;
+                break;
+
+            case scan_state::COMMENT:
+                if (c == '\n')
+                    state_ = scan_state::NORMAL;
+                else
+                    ++pos;
+                break;
+
+            case scan_state::BASIC_STRING:
+            case scan_state::LITERAL_STRING:
+                if (c == '\n')
+                {
+                    // unterminated; the line is still over
+                    state_ = scan_state::NORMAL;
+                    break;
+                }
+
+                if (c == '\\' && state_ == scan_state::BASIC_STRING)
+                {
+                    if (pending(pos + 1))
+                    {
+                        scanned_ = pos;
+                        return;
+                    }
+                    if (at(pos + 1) != '\n')
+                        ++pos;
+                }
+                else if (c == (state_ == scan_state::BASIC_STRING ? '"' : '\''))
+                {
+                    state_ = scan_state::NORMAL;
+                }
+                ++pos;
+                break;
+
+            case scan_state::MULTILINE_BASIC_STRING:
+            case scan_state::MULTILINE_LITERAL_STRING:
+            {
+                bool basic = state_ == scan_state::MULTILINE_BASIC_STRING;
+                char delim = basic ? '"' : '\'';
+                if (c == '\\' && basic)
+                {
+                    pos += 2;
+                    break;
+                }
+
+                if (c == delim)
+                {
+                    if (pending(pos + 2))
+                    {
+                        scanned_ = pos;
+                        return;
+                    }
+
+                    if (at(pos + 1) == delim && at(pos + 2) == delim)
+                    {
+                        state_ = scan_state::NORMAL;
+                        pos += 2;
+                    }
+                }
+                ++pos;
+                break;
+            }
+        }
+    }
+
+    // a skipped escape may leave pos past the end of the buffer, in which
+    // case the escaped character is the first one of the next chunk
+    scanned_ = pos;
+}
+
+void push_parser::parse_prefix(std::size_t len, bool is_final)
+{
+    parser_.buffer_ = buffer_.data();
+    parser_.buffer_end_ = buffer_.data() + len;
+    parser_.buffer_is_final_ = is_final;
+    parser_.parse();
+
+    buffer_.erase(0, len);
+    scanned_ -= len;
+    complete_ = 0;
+}
+
+toml_reader::toml_reader(std::istream& stream)
+    : values_(new detail::dom_builder), parser_(stream, *this)
+{
+    values_->set_location(parser_);
+}
+
+toml_reader::toml_reader(const char* data, std::size_t len)
+    : values_(new detail::dom_builder), parser_(data, len, *this)
+{
+    values_->set_location(parser_);
+}
+
+toml_reader::~toml_reader() = default;
+
+toml_reader::event toml_reader::next()
+{
+    if (lookahead_)
+    {
+        lookahead_ = false;
+        return event_;
+    }
+
+    if (event_ == event::KEY)
+        finish_key_value();
+
+    if (!next_statement())
+        return event_ = event::END;
+
+    if (*it_ == '[')
+    {
+        // the handler callbacks record the header
+        parser_.parse_table(it_, end_);
+        return event_;
+    }
+
+    parser_.parse_key(it_, end_, [](char c) { return c == '='; });
+    if (it_ == end_ || *it_ != '=')
+        parser_.throw_parse_exception("Value must follow after a '='");
+    ++it_;
+    parser_.consume_whitespace(it_, end_);
+
+    key_ = parser_.key_;
+    value_pending_ = true;
+    return event_ = event::KEY;
+}
+
+std::shared_ptr<base> toml_reader::value()
+{
+    if (event_ != event::KEY || !value_pending_)
+        return nullptr;
+
+    value_pending_ = false;
+    values_->begin_value();
+    parser_.parse_value(it_, end_);
+    return values_->take_value();
+}
+
+void toml_reader::skip()
+{
+    if (event_ == event::KEY)
+    {
+        if (value_pending_)
+        {
+            parser_.skip_value(it_, end_);
+            value_pending_ = false;
+        }
+        return;
+    }
+
+    if ((event_ != event::TABLE && event_ != event::TABLE_ARRAY) || lookahead_)
+        return;
+
+    auto section = table_;
+    auto nested = [&]() {
+        return table_.size() > section.size()
+               && std::equal(section.begin(), section.end(), table_.begin());
+    };
+
+    while (next_statement())
+    {
+        if (*it_ == '[')
+        {
+            parser_.parse_table(it_, end_);
+            if (nested())
+                continue;
+            lookahead_ = true;
+            return;
+        }
+
+        // find the '=' outside of any quoted key part
+        while (it_ != end_ && *it_ != '=')
+        {
+            if (*it_ == '"' || *it_ == '\'')
+                parser_.skip_string(it_, end_);
+            else
+                ++it_;
+        }
+        if (it_ == end_)
+            parser_.throw_parse_exception("Value must follow after a '='");
+        ++it_;
+        parser_.consume_whitespace(it_, end_);
+        parser_.skip_value(it_, end_);
+        parser_.consume_whitespace(it_, end_);
+        parser_.eol_or_comment(it_, end_);
+    }
+
+    event_ = event::END;
+    lookahead_ = true;
+}
+
+bool toml_reader::next_statement()
+{
+    while (parser_.next_line())
+    {
+        parser_.line_number_++;
+        it_ = parser_.line_begin_;
+        end_ = parser_.line_end_;
+        parser_.consume_whitespace(it_, end_);
+        if (it_ != end_ && *it_ != '#')
+            return true;
+    }
+    return false;
+}
+
+void toml_reader::finish_key_value()
+{
+    skip();
+    parser_.consume_whitespace(it_, end_);
+    parser_.eol_or_comment(it_, end_);
+}
+
+void toml_reader::table_header(const std::vector<std::string>& path)
+{
+    event_ = event::TABLE;
+    table_ = path;
+}
+
+void toml_reader::table_array_header(const std::vector<std::string>& path)
+{
+    event_ = event::TABLE_ARRAY;
+    table_ = path;
+}
+
+void toml_reader::key(const std::vector<std::string>& path)
+{
+    // only keys inside inline tables get here
+    values_->key(path);
+}
+
+void toml_reader::string_value(const std::string& v)
+{
+    values_->string_value(v);
+}
+
+void toml_reader::integer_value(int64_t v)
+{
+    values_->integer_value(v);
+}
+
+void toml_reader::float_value(double v)
+{
+    values_->float_value(v);
+}
+
+void toml_reader::integer_lexeme(const std::string& text)
+{
+    values_->integer_lexeme(text);
+}
+
+void toml_reader::float_lexeme(const std::string& text)
+{
+    values_->float_lexeme(text);
+}
+
+void toml_reader::boolean_value(bool v)
+{
+    values_->boolean_value(v);
+}
+
+void toml_reader::value_text(std::string_view text)
+{
+    values_->value_text(text);
+}
+
+void toml_reader::local_date_value(const local_date& v)
+{
+    values_->local_date_value(v);
+}
+
+void toml_reader::local_time_value(const local_time& v)
+{
+    values_->local_time_value(v);
+}
+
+void toml_reader::local_datetime_value(const local_datetime& v)
+{
+    values_->local_datetime_value(v);
+}
+
+void toml_reader::offset_datetime_value(const offset_datetime& v)
+{
+    values_->offset_datetime_value(v);
+}
+
+void toml_reader::begin_array()
+{
+    values_->begin_array();
+}
+
+void toml_reader::end_array()
+{
+    values_->end_array();
+}
+
+void toml_reader::begin_inline_table()
+{
+    values_->begin_inline_table();
+}
+
+void toml_reader::end_inline_table()
+{
+    values_->end_inline_table();
+}
 }
@@ -27,6 +27,7 @@ void array::push_back(const std::shared_ptr<array>& val)
     if (values_.empty() || values_[0]->is_array())
     {
         values_.push_back(val);
+        mark_dirty();
     }
     else
     {
@@ -39,6 +40,7 @@ array::insert(iterator position, const std::shared_ptr<array>& value)
 {
     if (values_.empty() || values_[0]->is_array())
     {
+        mark_dirty();
         return values_.insert(position, value);
     }
     else
@@ -117,9 +119,9 @@ bool table::resolve_qualified(const std::string& key,
     }
 
     if (!p)
-        return cur_table->map_.count(last_key) != 0;
+        return cur_table->contains(last_key);
 
-    *p = cur_table->map_.at(last_key);
+    *p = cur_table->get(last_key);
     return true;
 }
 
@@ -1,59 +1,332 @@
 #include "cpptoml.h"
 
-#include <sstream>
+#include <atomic>
 #include <cassert>
+#include <cerrno>
+#include <charconv>
+#include <cmath>
 #include <clocale>
-#include <iomanip>
+#include <string_view>
+#include <system_error>
+#include <thread>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/uio.h>
+#include <unistd.h>
+#define CPPTOMLNG_HAVE_UNISTD 1
+#elif defined(_WIN32)
+#include <io.h>
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define CPPTOMLNG_HAVE_SSE2 1
+#endif
 
 namespace cpptomlng
 {
 
+namespace detail
+{
+/**
+ * What a caching toml_writer wrote for a table, and under which key.
+ */
+struct write_cache
+{
+    std::vector<std::string> path;
+    std::string indent;
+    bool in_array = false;
+    std::string text;
+};
+} // namespace detail
+
+static bool is_digit(char c)
+{
+    return c >= '0' && c <= '9';
+}
+
+struct bare_key_char_table
+{
+    constexpr bare_key_char_table() : values{}
+    {
+        for (auto c : "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz"
+                      "0123456789_-")
+            values[static_cast<unsigned char>(c)] = c != '\0';
+    }
+
+    bool values[256];
+};
+
+constexpr bare_key_char_table bare_key_chars{};
+
+/**
+ * Returns whether a key can be written without quotes.
+ */
+static bool is_bare_key(std::string_view key)
+{
+    // an empty key has to be written as ""
+    if (key.empty())
+        return false;
+
+    return std::all_of(key.begin(), key.end(), [](char c) {
+        return bare_key_chars.values[static_cast<unsigned char>(c)];
+    });
+}
+
+void output_sink::write_through(const char* data, std::size_t len)
+{
+    auto buffered = static_cast<std::size_t>(pos_ - buffer_.get());
+    if (len < buffer_size)
+    {
+        flush();
+        std::memcpy(pos_, data, len);
+        pos_ += len;
+        return;
+    }
+
+    // too large to be worth copying
+    pos_ = buffer_.get();
+    flush_buffers(buffer_.get(), buffered, data, len);
+}
+
+void fd_sink::flush_buffer(const char* data, std::size_t len)
+{
+    while (len > 0)
+    {
+#if defined(CPPTOMLNG_HAVE_UNISTD)
+        auto n = ::write(fd_, data, len);
+#elif defined(_WIN32)
+        auto n = ::_write(fd_, data, static_cast<unsigned>(
+                                         std::min<std::size_t>(len, 1 << 30)));
+#else
+        errno = ENOSYS;
+        int n = -1;
+#endif
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            throw std::system_error{errno, std::generic_category(), "write"};
+        }
+        data += n;
+        len -= static_cast<std::size_t>(n);
+    }
+}
+
+void fd_sink::flush_buffers(const char* data, std::size_t len,
+                            const char* more, std::size_t more_len)
+{
+#ifdef CPPTOMLNG_HAVE_UNISTD
+    iovec iov[2] = {{const_cast<char*>(data), len},
+                    {const_cast<char*>(more), more_len}};
+    iovec* next = len > 0 ? iov : iov + 1;
+    int count = static_cast<int>(iov + 2 - next);
+    while (count > 0)
+    {
+        auto n = ::writev(fd_, next, count);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            throw std::system_error{errno, std::generic_category(), "writev"};
+        }
+
+        // skip what was written, which may end in the middle of a piece
+        auto written = static_cast<std::size_t>(n);
+        while (count > 0 && written >= next->iov_len)
+        {
+            written -= next->iov_len;
+            ++next;
+            --count;
+        }
+        if (count > 0)
+        {
+            next->iov_base = static_cast<char*>(next->iov_base) + written;
+            next->iov_len -= written;
+        }
+    }
+#else
+    output_sink::flush_buffers(data, len, more, more_len);
+#endif
+}
+
 /**
  * Output a table element of the TOML tree
  */
 void toml_writer::visit(const table& t, bool in_array)
 {
+    if (caching_ && !path_.empty())
+        write_cached(t, in_array);
+    else
+        write_table(t, in_array);
+}
+
+/**
+ * Output a table and everything in it.
+ */
+void toml_writer::write_table(const table& t, bool in_array)
+{
+    ++depth_;
     write_table_header(in_array);
-    std::vector<std::string> values;
-    std::vector<std::string> tables;
 
-    for (const auto& i : t)
+    // values first, as they would otherwise end up in the last subtable
+    bool first = true;
+    for (const auto& entry : t)
+    {
+        if (caching_)
+            adopt(*entry.second, t);
+        if (!entry.second->is_table() && !entry.second->is_table_array())
+        {
+            if (!first)
+                endline();
+            first = false;
+            write_entry(entry.first, *entry.second);
+        }
+    }
+
+    if (threads_ == 1)
+    {
+        for (const auto& entry : t)
+        {
+            if (entry.second->is_table() || entry.second->is_table_array())
+            {
+                if (!first)
+                    endline();
+                first = false;
+                write_entry(entry.first, *entry.second);
+            }
+        }
+    }
+    else
     {
-        if (i.second->is_table() || i.second->is_table_array())
+        std::vector<const string_to_base_map::value_type*> tables;
+        for (const auto& entry : t)
+        {
+            if (entry.second->is_table() || entry.second->is_table_array())
+                tables.push_back(&entry);
+        }
+
+        auto write_table = [&, first](toml_writer& w, std::size_t i) {
+            if (!first || i > 0)
+                w.endline();
+            w.write_entry(tables[i]->first, *tables[i]->second);
+        };
+        auto threads = threads_for(tables.size());
+        if (threads > 1)
         {
-            tables.push_back(i.first);
+            write_in_parallel(tables.size(), threads, write_table);
         }
         else
         {
-            values.push_back(i.first);
+            for (std::size_t i = 0; i < tables.size(); ++i)
+                write_table(*this, i);
         }
     }
 
-    for (unsigned int i = 0; i < values.size(); ++i)
-    {
-        path_.push_back(values[i]);
+    endline();
+    if (--depth_ == 0)
+        sink_.flush();
+}
 
-        if (i > 0)
-            endline();
+/**
+ * Output a table, or the text cached for it if nothing in it has changed
+ * and it is written under the same key as last time.
+ */
+void toml_writer::write_cached(const table& t, bool in_array)
+{
+    auto same_path = [&](const std::vector<std::string>& path) {
+        return std::equal(path.begin(), path.end(), path_.begin(),
+                          path_.end(),
+                          [](const std::string& name, const path_entry& e) {
+                              return name == *e.name;
+                          });
+    };
+
+    if (!t.write_state_)
+        t.write_state_ = std::make_unique<detail::write_state>();
+    auto& state = *t.write_state_;
 
-        write_table_item_header(*t.get(values[i]));
-        t.get(values[i])->accept(*this, false);
-        path_.pop_back();
+    auto cache = std::move(state.cache);
+    if (cache && !state.dirty && cache->in_array == in_array
+        && cache->indent == indent_ && same_path(cache->path))
+    {
+        sink_.write(cache->text);
+        has_naked_endline_ = true;
+        state.cache = std::move(cache);
+        return;
     }
 
-    for (unsigned int i = 0; i < tables.size(); ++i)
+    // the table is written to the cache first and then copied out; the
+    // cache is only put back once it is complete
+    if (!cache)
+        cache = std::make_shared<detail::write_cache>();
+    cache->text.clear();
+    string_sink sink{cache->text};
+    toml_writer writer{sink, indent_};
+    writer.caching_ = true;
+    writer.path_ = path_;
+    writer.depth_ = depth_;
+    writer.has_naked_endline_ = has_naked_endline_;
+    writer.write_table(t, in_array);
+    sink.flush();
+
+    sink_.write(cache->text);
+    has_naked_endline_ = writer.has_naked_endline_;
+    if (writer.uncacheable_)
     {
-        path_.push_back(tables[i]);
+        uncacheable_ = true;
+        return;
+    }
 
-        if (values.size() > 0 || i > 0)
-            endline();
+    cache->in_array = in_array;
+    cache->indent = indent_;
+    cache->path.clear();
+    for (const auto& e : path_)
+        cache->path.push_back(*e.name);
+    state.cache = std::move(cache);
+    state.dirty = false;
+}
+
+/**
+ * Record that child is written in parent, so that a change to child marks
+ * parent dirty too.
+ */
+void toml_writer::adopt(const base& child, const base& parent)
+{
+    if (!child.write_state_)
+        child.write_state_ = std::make_unique<detail::write_state>();
+    auto& state = *child.write_state_;
 
-        write_table_item_header(*t.get(tables[i]));
-        t.get(tables[i])->accept(*this, false);
-        path_.pop_back();
+    auto old = state.parent.lock();
+    if (!old)
+    {
+        state.parent = parent.weak_from_this();
+    }
+    else if (old.get() != &parent)
+    {
+        // a change to child is only passed up to one of its containers,
+        // so none of the tables around it can be cached from now on
+        state.shared = true;
+        old->mark_dirty();
     }
 
-    endline();
+    if (state.shared)
+        uncacheable_ = true;
+
+    // tables are clean once their text has been cached
+    if (!child.is_table())
+        state.dirty = false;
+}
+
+/**
+ * Output a key of a table and what it holds.
+ */
+void toml_writer::write_entry(const std::string& key, const base& b)
+{
+    path_.push_back({&key, is_bare_key(key)});
+    write_table_item_header(b);
+    b.accept(*this, false);
+    path_.pop_back();
 }
 
 /**
@@ -61,6 +334,7 @@ void toml_writer::visit(const table& t, bool in_array)
  */
 void toml_writer::visit(const array& a, bool)
 {
+    ++depth_;
     write("[");
 
     for (unsigned int i = 0; i < a.get().size(); ++i)
@@ -68,6 +342,9 @@ void toml_writer::visit(const array& a, bool)
         if (i > 0)
             write(", ");
 
+        if (caching_)
+            adopt(*a.get()[i], a);
+
         if (a.get()[i]->is_array())
         {
             a.get()[i]->as_array()->accept(*this, true);
@@ -79,6 +356,8 @@ void toml_writer::visit(const array& a, bool)
     }
 
     write("]");
+    if (--depth_ == 0)
+        sink_.flush();
 }
 
 /**
@@ -86,75 +365,246 @@ void toml_writer::visit(const array& a, bool)
  */
 void toml_writer::visit(const table_array& t, bool)
 {
-    for (unsigned int j = 0; j < t.get().size(); ++j)
+    ++depth_;
+    auto threads = threads_for(t.get().size());
+    if (threads > 1)
     {
-        if (j > 0)
-            endline();
+        const auto& entries = t.get();
+        write_in_parallel(entries.size(), threads,
+                          [&](toml_writer& w, std::size_t j) {
+                              if (j > 0)
+                                  w.endline();
+                              entries[j]->accept(w, true);
+                          });
+    }
+    else
+    {
+        for (unsigned int j = 0; j < t.get().size(); ++j)
+        {
+            if (j > 0)
+                endline();
 
-        t.get()[j]->accept(*this, true);
+            if (caching_)
+                adopt(*t.get()[j], t);
+            t.get()[j]->accept(*this, true);
+        }
     }
 
     endline();
+    if (--depth_ == 0)
+        sink_.flush();
+}
+
+void toml_writer::set_threads(unsigned threads)
+{
+    if (threads == 0)
+        threads = std::thread::hardware_concurrency();
+    threads_ = std::max(threads, 1u);
 }
 
 /**
- * Escape a string for output.
+ * Returns how many threads to write a run of count entries on.
  */
-std::string toml_writer::escape_string(const std::string& str)
+unsigned toml_writer::threads_for(std::size_t count) const
 {
-    std::string res;
-    for (auto it = str.begin(); it != str.end(); ++it)
-    {
-        if (*it == '\b')
-        {
-            res += "\\b";
-        }
-        else if (*it == '\t')
-        {
-            res += "\\t";
-        }
-        else if (*it == '\n')
-        {
-            res += "\\n";
-        }
-        else if (*it == '\f')
-        {
-            res += "\\f";
-        }
-        else if (*it == '\r')
-        {
-            res += "\\r";
-        }
-        else if (*it == '"')
-        {
-            res += "\\\"";
-        }
-        else if (*it == '\\')
+    // below this many entries per thread, starting threads costs more
+    // than it saves
+    constexpr std::size_t min_entries_per_thread = 32;
+
+    if (caching_)
+        return 1;
+
+    return static_cast<unsigned>(
+        std::min<std::size_t>(threads_, count / min_entries_per_thread));
+}
+
+template <class F>
+void toml_writer::write_in_parallel(std::size_t count, unsigned threads,
+                                    F write_entry)
+{
+    // more runs than threads, so that a thread that got small entries can
+    // take another run while the others are still busy
+    auto run_count = std::min<std::size_t>(count, threads * 8);
+    std::vector<std::string> runs(run_count);
+    std::vector<std::exception_ptr> errors(run_count);
+    std::atomic<std::size_t> next{0};
+
+    auto work = [&]() {
+        for (std::size_t r; (r = next++) < run_count;)
         {
-            res += "\\\\";
+            try
+            {
+                // every entry ends with an endline, so every run but the
+                // first starts right after one
+                string_sink sink{runs[r]};
+                toml_writer writer{sink, indent_};
+                writer.path_ = path_;
+                writer.depth_ = depth_;
+                writer.has_naked_endline_ = r == 0 ? has_naked_endline_ : true;
+                for (auto i = count * r / run_count;
+                     i < count * (r + 1) / run_count; ++i)
+                    write_entry(writer, i);
+                sink.flush();
+            }
+            catch (...)
+            {
+                errors[r] = std::current_exception();
+            }
         }
-        else if (static_cast<uint32_t>(*it) <= UINT32_C(0x001f))
+    };
+
+    std::vector<std::thread> workers;
+    for (unsigned i = 1; i < threads; ++i)
+        workers.emplace_back(work);
+    work();
+    for (auto& worker : workers)
+        worker.join();
+
+    for (const auto& error : errors)
+    {
+        if (error)
+            std::rethrow_exception(error);
+    }
+    for (const auto& run : runs)
+        sink_.write(run);
+    has_naked_endline_ = true;
+}
+
+/**
+ * Returns whether a character has to be escaped in a basic string:
+ * quotes, backslashes and control characters.
+ */
+static bool needs_escape(char c)
+{
+    return static_cast<unsigned char>(c) < 0x20 || c == '"' || c == '\\';
+}
+
+/**
+ * Returns the first character in [p, end) that has to be escaped, or end.
+ */
+static const char* find_escape(const char* p, const char* end)
+{
+#ifdef CPPTOMLNG_HAVE_SSE2
+    const auto quote = _mm_set1_epi8('"');
+    const auto backslash = _mm_set1_epi8('\\');
+    const auto last_control = _mm_set1_epi8(0x1f);
+    for (; end - p >= 16; p += 16)
+    {
+        auto v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        auto m = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(v, quote),
+                         _mm_cmpeq_epi8(v, backslash)),
+            _mm_cmpeq_epi8(_mm_min_epu8(v, last_control), v));
+        auto bits = static_cast<unsigned>(_mm_movemask_epi8(m));
+        if (bits)
         {
-            res += "\\u";
-            std::stringstream ss;
-            ss << std::hex << static_cast<uint32_t>(*it);
-            res += ss.str();
+#if defined __GNUC__
+            return p + __builtin_ctz(bits);
+#else
+            while (!(bits & 1))
+            {
+                bits >>= 1;
+                ++p;
+            }
+            return p;
+#endif
         }
-        else
+    }
+#endif
+    while (p != end && !needs_escape(*p))
+        ++p;
+    return p;
+}
+
+/**
+ * Escapes [p, end), handing clean runs to out unchanged and escapes as
+ * they are found. out is called with a pointer and a length.
+ */
+template <class Output>
+static void escape(const char* p, const char* end, Output&& out)
+{
+    static const char hex[] = "0123456789abcdef";
+    while (true)
+    {
+        auto next = find_escape(p, end);
+        if (next != p)
+            out(p, static_cast<std::size_t>(next - p));
+        if (next == end)
+            return;
+
+        char buf[6] = {'\\'};
+        std::size_t len = 2;
+        switch (*next)
         {
-            res += *it;
+            case '\b':
+                buf[1] = 'b';
+                break;
+            case '\t':
+                buf[1] = 't';
+                break;
+            case '\n':
+                buf[1] = 'n';
+                break;
+            case '\f':
+                buf[1] = 'f';
+                break;
+            case '\r':
+                buf[1] = 'r';
+                break;
+            case '"':
+            case '\\':
+                buf[1] = *next;
+                break;
+            default:
+            {
+                auto c = static_cast<unsigned char>(*next);
+                buf[1] = 'u';
+                buf[2] = '0';
+                buf[3] = '0';
+                buf[4] = hex[c >> 4];
+                buf[5] = hex[c & 0xf];
+                len = 6;
+            }
         }
+        out(buf, len);
+        p = next + 1;
     }
+}
+
+/**
+ * Escape a string for output.
+ */
+std::string toml_writer::escape_string(const std::string& str)
+{
+    auto begin = str.data();
+    auto end = begin + str.size();
+    if (find_escape(begin, end) == end)
+        return str;
+
+    std::string res;
+    res.reserve(str.size() + 16);
+    escape(begin, end,
+           [&](const char* data, std::size_t len) { res.append(data, len); });
     return res;
 }
 
+/**
+ * Write out a string escaped, straight into the sink.
+ */
+void toml_writer::write_escaped(std::string_view str)
+{
+    escape(str.data(), str.data() + str.size(),
+           [&](const char* data, std::size_t len) { sink_.write(data, len); });
+    has_naked_endline_ = false;
+}
+
 /**
  * Write out a string.
  */
 void toml_writer::write(const value<std::string>& v)
 {
     write("\"");
-    write(escape_string(v.get()));
+    write_escaped(v.get());
     write("\"");
 }
 
@@ -163,20 +613,57 @@ void toml_writer::write(const value<std::string>& v)
  */
 void toml_writer::write(const value<double>& v)
 {
-    std::stringstream ss;
-    ss << std::showpoint
-       << std::setprecision(std::numeric_limits<double>::max_digits10)
-       << v.get();
+    write(v.get());
+}
 
-    auto double_str = ss.str();
-    auto pos = double_str.find("e0");
-    if (pos != std::string::npos)
-        double_str.replace(pos, 2, "e");
-    pos = double_str.find("e-0");
-    if (pos != std::string::npos)
-        double_str.replace(pos, 3, "e-");
+/**
+ * Write out a double, as a stream with showpoint and max_digits10
+ * precision would.
+ */
+void toml_writer::write(double v)
+{
+    constexpr int precision = std::numeric_limits<double>::max_digits10;
+    char buf[48];
+    auto end = std::to_chars(buf, buf + sizeof(buf), v,
+                             std::chars_format::general, precision)
+                   .ptr;
+
+    // showpoint keeps the decimal point and the trailing zeros that the
+    // general format drops
+    auto exponent = std::find(buf, end, 'e');
+    auto first = buf[0] == '-' ? buf + 1 : buf;
+    if (is_digit(*first))
+    {
+        auto point = std::find(first, exponent, '.');
+        auto significant = std::find_if(
+            first, exponent, [](char c) { return c != '0' && c != '.'; });
+        auto digits = significant == exponent
+                          ? 1
+                          : std::count_if(significant, exponent, is_digit);
+        auto pad = precision - digits + (point == exponent ? 1 : 0);
+        std::memmove(exponent + pad, exponent,
+                     static_cast<std::size_t>(end - exponent));
+        if (point == exponent)
+            *exponent++ = '.';
+        std::fill(exponent, exponent + (precision - digits), '0');
+        end += pad;
+    }
 
-    stream_ << double_str;
+    std::string_view double_str{buf, static_cast<std::size_t>(end - buf)};
+    auto pos = double_str.find("e0");
+    if (pos == std::string_view::npos)
+        pos = double_str.find("e-0");
+    if (pos != std::string_view::npos)
+    {
+        // drop the leading zero of the exponent
+        auto zero = double_str.find('0', pos);
+        sink_.write(buf, zero);
+        sink_.write(buf + zero + 1, double_str.size() - zero - 1);
+    }
+    else
+    {
+        sink_.write(buf, double_str.size());
+    }
     has_naked_endline_ = false;
 }
 
@@ -188,6 +675,52 @@ void toml_writer::write(const value<bool>& v)
     write((v.get() ? "true" : "false"));
 }
 
+/**
+ * Write out an integer.
+ */
+void toml_writer::write(int64_t v)
+{
+    char buf[24];
+    auto end = std::to_chars(buf, buf + sizeof(buf), v).ptr;
+    sink_.write(buf, static_cast<std::size_t>(end - buf));
+    has_naked_endline_ = false;
+}
+
+/**
+ * Write out a date or time.
+ */
+template <class T>
+static void write_datetime(output_sink& sink, const T& v)
+{
+    char buf[detail::datetime_buffer_size];
+    auto end = detail::format_datetime(buf, v);
+    sink.write(buf, static_cast<std::size_t>(end - buf));
+}
+
+void toml_writer::write(const local_date& v)
+{
+    write_datetime(sink_, v);
+    has_naked_endline_ = false;
+}
+
+void toml_writer::write(const local_time& v)
+{
+    write_datetime(sink_, v);
+    has_naked_endline_ = false;
+}
+
+void toml_writer::write(const local_datetime& v)
+{
+    write_datetime(sink_, v);
+    has_naked_endline_ = false;
+}
+
+void toml_writer::write(const offset_datetime& v)
+{
+    write_datetime(sink_, v);
+    has_naked_endline_ = false;
+}
+
 /**
  * Write out the header of a table.
  */
@@ -208,22 +741,10 @@ void toml_writer::write_table_header(bool in_array)
         {
             if (i > 0)
             {
-                write(".");
+                write('.');
             }
 
-            if (path_[i].find_first_not_of("ABCDEFGHIJKLMNOPQRSTUVWXYZabcde"
-                                           "fghijklmnopqrstuvwxyz0123456789"
-                                           "_-")
-                == std::string::npos)
-            {
-                write(path_[i]);
-            }
-            else
-            {
-                write("\"");
-                write(escape_string(path_[i]));
-                write("\"");
-            }
+            write_key(path_[i]);
         }
 
         if (in_array)
@@ -245,24 +766,43 @@ void toml_writer::write_table_item_header(const base& b)
     {
         indent();
 
-        if (path_.back().find_first_not_of("ABCDEFGHIJKLMNOPQRSTUVWXYZabcde"
-                                           "fghijklmnopqrstuvwxyz0123456789"
-                                           "_-")
-            == std::string::npos)
-        {
-            write(path_.back());
-        }
-        else
-        {
-            write("\"");
-            write(escape_string(path_.back()));
-            write("\"");
-        }
+        write_key(path_.back());
 
         write(" = ");
     }
 }
 
+/**
+ * Write out a key, in quotes unless it is a bare key.
+ */
+void toml_writer::write_key(const path_entry& key)
+{
+    write_key(*key.name, key.bare);
+}
+
+void toml_writer::write_key(std::string_view name, bool bare)
+{
+    if (bare)
+    {
+        write(name);
+    }
+    else
+    {
+        write('"');
+        write_escaped(name);
+        write('"');
+    }
+}
+
+/**
+ * Write out a single character.
+ */
+void toml_writer::write(char ch)
+{
+    sink_.write(ch);
+    has_naked_endline_ = false;
+}
+
 /**
  * Indent the proper number of tabs given the size of
  * the path.
@@ -280,9 +820,347 @@ void toml_writer::endline()
 {
     if (!has_naked_endline_)
     {
-        stream_ << "\n";
+        sink_.write('\n');
         has_naked_endline_ = true;
     }
 }
 
+void toml_emitter::begin_table(std::initializer_list<std::string_view> path)
+{
+    write_header(path, false);
+}
+
+void toml_emitter::begin_table(const std::vector<std::string>& path)
+{
+    write_header(path, false);
+}
+
+void toml_emitter::begin_table_array_entry(
+    std::initializer_list<std::string_view> path)
+{
+    write_header(path, true);
+}
+
+void toml_emitter::begin_table_array_entry(const std::vector<std::string>& path)
+{
+    write_header(path, true);
+}
+
+template <class Path>
+void toml_emitter::write_header(const Path& path, bool in_array)
+{
+    if (!arrays_.empty())
+        throw std::logic_error{"toml_emitter: table started in an array"};
+    if (path.size() == 0)
+        throw std::logic_error{"toml_emitter: table without a name"};
+
+    writer_.write(in_array ? "[[" : "[");
+    bool first = true;
+    for (std::string_view key : path)
+    {
+        if (!first)
+            writer_.write('.');
+        first = false;
+        writer_.write_key(key, is_bare_key(key));
+    }
+    writer_.write(in_array ? "]]" : "]");
+    writer_.endline();
+}
+
+void toml_emitter::begin_array(std::string_view key)
+{
+    begin_key(key);
+    writer_.write('[');
+    arrays_.push_back(0);
+}
+
+void toml_emitter::begin_array()
+{
+    begin_element();
+    writer_.write('[');
+    arrays_.push_back(0);
+}
+
+void toml_emitter::end_array()
+{
+    if (arrays_.empty())
+        throw std::logic_error{"toml_emitter: no array to end"};
+
+    writer_.write(']');
+    arrays_.pop_back();
+    if (arrays_.empty())
+        writer_.endline();
+}
+
+void toml_emitter::finish()
+{
+    if (!arrays_.empty())
+        throw std::logic_error{"toml_emitter: array left open"};
+
+    flush();
+}
+
+void toml_emitter::begin_key(std::string_view key)
+{
+    if (!arrays_.empty())
+        throw std::logic_error{"toml_emitter: key written in an array"};
+
+    writer_.write_key(key, is_bare_key(key));
+    writer_.write(" = ");
+}
+
+void toml_emitter::begin_element()
+{
+    if (arrays_.empty())
+        throw std::logic_error{"toml_emitter: value written outside an array"};
+
+    if (arrays_.back()++ > 0)
+        writer_.write(", ");
+}
+
+void toml_emitter::write_string(std::string_view val)
+{
+    writer_.write('"');
+    writer_.write_escaped(val);
+    writer_.write('"');
+}
+
+/**
+ * Output a table element of the TOML tree.
+ */
+void json_writer::visit(const table& t, bool)
+{
+    ++depth_;
+    sink_.write('{');
+    bool first = true;
+    for (const auto& entry : t)
+    {
+        if (!first)
+            sink_.write(',');
+        first = false;
+        write_string(entry.first);
+        sink_.write(':');
+        entry.second->accept(*this, false);
+    }
+    sink_.write('}');
+    if (--depth_ == 0)
+        sink_.flush();
+}
+
+/**
+ * Output an array element of the TOML tree.
+ */
+void json_writer::visit(const array& a, bool)
+{
+    ++depth_;
+    if (format_ == json_format::TYPED)
+        sink_.write("{\"type\":\"array\",\"value\":[");
+    else
+        sink_.write('[');
+
+    const auto& values = a.get();
+    for (std::size_t i = 0; i < values.size(); ++i)
+    {
+        if (i > 0)
+            sink_.write(',');
+        values[i]->accept(*this, true);
+    }
+
+    if (format_ == json_format::TYPED)
+        sink_.write("]}");
+    else
+        sink_.write(']');
+    if (--depth_ == 0)
+        sink_.flush();
+}
+
+/**
+ * Output a table_array element of the TOML tree.
+ */
+void json_writer::visit(const table_array& t, bool)
+{
+    ++depth_;
+    sink_.write('[');
+    const auto& tables = t.get();
+    for (std::size_t i = 0; i < tables.size(); ++i)
+    {
+        if (i > 0)
+            sink_.write(',');
+        tables[i]->accept(*this, true);
+    }
+    sink_.write(']');
+    if (--depth_ == 0)
+        sink_.flush();
+}
+
+void json_writer::write(const std::string& v)
+{
+    if (format_ == json_format::TYPED)
+    {
+        sink_.write("{\"type\":\"string\",\"value\":");
+        write_string(v);
+        sink_.write('}');
+    }
+    else
+    {
+        write_string(v);
+    }
+}
+
+void json_writer::write(int64_t v)
+{
+    char buf[24];
+    auto end = std::to_chars(buf, buf + sizeof(buf), v).ptr;
+    write_value("integer", {buf, static_cast<std::size_t>(end - buf)}, false);
+}
+
+void json_writer::write(double v)
+{
+    if (std::isfinite(v))
+    {
+        char buf[32];
+        auto end = std::to_chars(buf, buf + sizeof(buf), v).ptr;
+        write_value("float", {buf, static_cast<std::size_t>(end - buf)},
+                    false);
+    }
+    else if (format_ == json_format::TYPED)
+    {
+        write_value("float", std::isnan(v) ? "nan" : v < 0 ? "-inf" : "inf",
+                    false);
+    }
+    else
+    {
+        sink_.write("null");
+    }
+}
+
+void json_writer::write(bool v)
+{
+    write_value("bool", v ? "true" : "false", false);
+}
+
+void json_writer::write(const local_date& v)
+{
+    char buf[detail::datetime_buffer_size];
+    auto end = detail::format_datetime(buf, v);
+    write_value("local_date", {buf, static_cast<std::size_t>(end - buf)},
+                true);
+}
+
+void json_writer::write(const local_time& v)
+{
+    char buf[detail::datetime_buffer_size];
+    auto end = detail::format_datetime(buf, v);
+    write_value("local_time", {buf, static_cast<std::size_t>(end - buf)},
+                true);
+}
+
+void json_writer::write(const local_datetime& v)
+{
+    char buf[detail::datetime_buffer_size];
+    auto end = detail::format_datetime(buf, v);
+    write_value("local_datetime", {buf, static_cast<std::size_t>(end - buf)},
+                true);
+}
+
+void json_writer::write(const offset_datetime& v)
+{
+    char buf[detail::datetime_buffer_size];
+    auto end = detail::format_datetime(buf, v);
+    write_value("datetime", {buf, static_cast<std::size_t>(end - buf)}, true);
+}
+
+/**
+ * Write out a quoted string. JSON needs the same characters escaped as
+ * TOML's basic strings, and accepts the same escapes for them.
+ */
+void json_writer::write_string(std::string_view str)
+{
+    sink_.write('"');
+    escape(str.data(), str.data() + str.size(),
+           [&](const char* data, std::size_t len) { sink_.write(data, len); });
+    sink_.write('"');
+}
+
+void json_writer::write_value(const char* type, std::string_view text,
+                              bool quoted)
+{
+    if (format_ == json_format::TYPED)
+    {
+        // none of the types or texts need escaping
+        sink_.write("{\"type\":\"");
+        sink_.write(type, std::strlen(type));
+        sink_.write("\",\"value\":\"");
+        sink_.write(text.data(), text.size());
+        sink_.write("\"}");
+    }
+    else if (quoted)
+    {
+        sink_.write('"');
+        sink_.write(text.data(), text.size());
+        sink_.write('"');
+    }
+    else
+    {
+        sink_.write(text.data(), text.size());
+    }
+}
+
+/**
+ * An output_sink that keeps what is written to it in pieces, so that it
+ * never copies what it already holds in order to grow.
+ */
+class piece_sink : public output_sink
+{
+  public:
+    ~piece_sink() override
+    {
+        flush_quietly();
+    }
+
+    std::size_t size() const
+    {
+        return size_;
+    }
+
+    void append_to(std::string& str) const
+    {
+        for (const auto& piece : pieces_)
+            str.append(piece);
+    }
+
+  protected:
+    void flush_buffer(const char* data, std::size_t len) override
+    {
+        pieces_.emplace_back(data, len);
+        size_ += len;
+    }
+
+  private:
+    std::vector<std::string> pieces_;
+    std::size_t size_ = 0;
+};
+
+/**
+ * Write a table out to the end of a string, which grows only once.
+ */
+void serialize_into(std::string& str, const table& t)
+{
+    // the size is only known once the table has been written, since
+    // measuring numbers costs as much as formatting them; so the first
+    // pass keeps its output rather than writing the table twice
+    piece_sink pieces;
+    toml_writer writer{pieces};
+    t.accept(writer);
+
+    str.reserve(str.size() + pieces.size());
+    pieces.append_to(str);
+}
+
+std::string to_string(const table& t)
+{
+    std::string str;
+    serialize_into(str, t);
+    return str;
+}
 }